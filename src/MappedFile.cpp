@@ -0,0 +1,58 @@
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (data_) { UnmapViewOfFile(data_); }
+    if (mapping_) { CloseHandle(mapping_); }
+    if (file_) { CloseHandle(file_); }
+#else
+    if (data_) { munmap(const_cast<uint8_t*>(data_), size_); }
+#endif
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::filesystem::path& path)
+{
+    auto result = std::make_shared<MappedFile>();
+#ifdef _WIN32
+    auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) { return nullptr; }
+    result->file_ = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) { return nullptr; }
+    result->mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!result->mapping_) { return nullptr; }
+    result->data_ = static_cast<const uint8_t*>(MapViewOfFile(result->mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (!result->data_) { return nullptr; }
+    result->size_ = size_t(size.QuadPart);
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) { return nullptr; }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+    // The mapping stays valid after the descriptor is closed
+    void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) { return nullptr; }
+    result->data_ = static_cast<const uint8_t*>(data);
+    result->size_ = size_t(st.st_size);
+#endif
+    return result;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+/// A read only memory mapping of a whole file
+struct MappedFile {
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    /// Maps a file, returns nullptr if it doesn't exist or can't be mapped
+    static std::shared_ptr<MappedFile> open(const std::filesystem::path& path);
+
+    std::span<const uint8_t> bytes() const noexcept { return {data_, size_}; }
+
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    void* file_ = nullptr;
+    void* mapping_ = nullptr;
+#endif
+};
@@ -1,36 +1,348 @@
 #include "ModelCache.hpp"
 
+#include "WorkerPool.hpp"
+#include "bake.hpp"
+#include "util.hpp"
+
 #include <nw/kernel/Resources.hpp>
 
-Model* ModelCache::load(std::string_view resref)
+// Gets the key bakes of a model are valid for, 0 if it doesn't exist.  Must be called with ``resman_mutex`` held.
+static uint64_t source_key(std::string_view resref)
 {
-    auto it = map_.find(std::string(resref));
-    if (it == std::end(map_)) {
+    auto desc = nw::kernel::resman().stat({resref, nw::ResourceType::mdl});
+    return desc.size ? bake_source_key(desc.size, desc.mtime) : 0;
+}
+
+// Gets what a bake of a parsed model derives from.  Must be called with ``resman_mutex`` held.
+static BakeSource bake_source(uint64_t key, const nw::model::Model& model)
+{
+    BakeSource result;
+    result.key = key;
+    std::vector<uint64_t> keys;
+    for (auto m = &model; m->supermodel; m = &m->supermodel->model) {
+        result.supermodels.push_back(nw::string::tolower(m->supermodel_name));
+        keys.push_back(source_key(m->supermodel_name));
+    }
+    std::vector<std::string_view> names(result.supermodels.begin(), result.supermodels.end());
+    result.chain_key = bake_chain_key(names, keys);
+    return result;
+}
+
+// Maps the bake of a model if neither it nor any of its supermodels changed since.  Only stats resources, so a
+// valid bake is used without demanding anything.
+static bool open_bake(const ModelCache& cache, std::string_view resref, BakedModel& bake)
+{
+    if (cache.bake_dir_.empty()) { return false; }
+    uint64_t key = 0;
+    {
+        std::lock_guard<std::mutex> lock(resman_mutex());
+        key = source_key(resref);
+    }
+    if (key == 0 || !bake.open(bake_path(cache.bake_dir_, resref, key), key)) { return false; }
+
+    auto names = bake.supermodels();
+    std::vector<uint64_t> keys;
+    {
+        std::lock_guard<std::mutex> lock(resman_mutex());
+        for (auto name : names) {
+            keys.push_back(source_key(name));
+        }
+    }
+    return bake_chain_key(names, keys) == bake.header_->chain_key;
+}
+
+// Demands and parses a model and its supermodel chain, filling ``source`` if baking is enabled.  Returns nullptr
+// on failure.
+static std::unique_ptr<nw::model::Mdl> parse(const ModelCache& cache, std::string_view resref, BakeSource& source)
+{
+    std::unique_ptr<nw::model::Mdl> result;
+    {
+        // Parsing demands the whole supermodel chain from the resource manager
+        std::lock_guard<std::mutex> lock(resman_mutex());
+        uint64_t key = cache.bake_dir_.empty() ? 0 : source_key(resref);
         auto rd = nw::kernel::resman().demand({resref, nw::ResourceType::mdl});
         if (rd.bytes.size() == 0) {
             LOG_F(ERROR, "Failed to find model: {}", resref);
             return nullptr;
         }
+        result = std::make_unique<nw::model::Mdl>(std::move(rd));
+        if (key && result->valid()) { source = bake_source(key, result->model); }
+    }
+    if (!result->valid()) {
+        LOG_F(ERROR, "Failed to parse model: {}", resref);
+        return nullptr;
+    }
+    return result;
+}
 
-        auto model = std::make_unique<nw::model::Mdl>(std::move(rd));
-        if (!model->valid()) {
-            LOG_F(ERROR, "Failed to parse model: {}", resref);
-            return nullptr;
-        }
-        auto mdl = new Model;
-        if (!mdl->load(&model.get()->model)) {
-            LOG_F(ERROR, "Failed to load model: {}", resref);
-            return nullptr;
+// Prepares a model without touching bgfx, so it can run on any thread.  A valid bake is loaded without
+// demanding or parsing the model, otherwise it's parsed, derived and baked for the next load.  The parsed model
+// is dropped once prepared.
+static bool prepare(ModelCache& cache, ModelPayload& payload, NameKey key)
+{
+    auto resref = key.view();
+
+    BakedModel bake;
+    if (open_bake(cache, resref, bake) && !(bake.header_->flags & bake_animations_only)) {
+        auto names = bake.supermodels();
+        auto supermodel = names.empty() ? nullptr : cache.acquire_supermodel(names.front());
+        if (names.empty() || supermodel) {
+            auto mdl = std::make_unique<Model>();
+            for (auto sm = supermodel; sm; sm = sm->parent_) {
+                mdl->supermodels_.push_back(sm->animations_.get());
+            }
+            if (mdl->load(bake)) {
+                LOG_F(INFO, "Loaded baked model: {}", resref);
+                payload.model_ = std::move(mdl);
+                payload.supermodel_ = supermodel;
+                return true;
+            }
+            mdl.reset();
+            cache.release_supermodels(supermodel);
         }
-        std::string name = std::string(rd.name.resref.view());
-        LOG_F(INFO, "Resref: {}", name);
-        map_.insert({name, ModelPayload{std::unique_ptr<Model>(mdl), std::move(model), 1}});
-        return mdl;
-    } else {
-        ++it->second.refcount_;
+    }
+
+    BakeSource source;
+    auto model = parse(cache, resref, source);
+    if (!model) { return false; }
+
+    auto supermodel = cache.share_supermodels(model->model);
+    auto mdl = std::make_unique<Model>();
+    for (auto sm = supermodel; sm; sm = sm->parent_) {
+        mdl->supermodels_.push_back(sm->animations_.get());
+    }
+    if (!mdl->load(&model->model)) {
+        LOG_F(ERROR, "Failed to load model: {}", resref);
+        mdl.reset();
+        cache.release_supermodels(supermodel);
+        return false;
+    }
+    if (source.key) { write_bake(cache.bake_dir_, resref, *mdl, source); }
+    payload.model_ = std::move(mdl);
+    payload.supermodel_ = supermodel;
+    return true;
+}
+
+Model* ModelCache::load(std::string_view resref)
+{
+    NameKey key{resref};
+    if (!key.valid()) {
+        LOG_F(ERROR, "Invalid model resref: {}", resref);
+        return nullptr;
+    }
+
+    auto it = map_.find(key);
+    if (it == std::end(map_)) {
+        ModelPayload payload;
+        if (!prepare(*this, payload, key)) { return nullptr; }
+        payload.model_->upload();
+        payload.bytes_ = payload.model_->gpu_bytes_ + payload.model_->source_bytes();
+        LOG_F(INFO, "Resref: {}", resref);
+
+        auto [entry, _] = map_.try_emplace(key);
+        entry->second.key_ = key;
+        entry->second.model_ = std::move(payload.model_);
+        entry->second.supermodel_ = payload.supermodel_;
+        entry->second.refcount_ = 1;
+        entry->second.bytes_ = payload.bytes_;
+        entry->second.state_ = ModelLoadState::ready;
+        bytes_ += payload.bytes_;
+        return entry->second.model_.get();
+    } else if (it->second.state_ == ModelLoadState::ready) {
+        if (it->second.refcount_++ == 0) { unused_.erase(it->second.unused_); }
         return it->second.model_.get();
     }
 
-    // Failure
+    // Failed or still loading
     return nullptr;
 }
+
+ModelPayload* ModelCache::load_async(std::string_view resref, WorkerPool& pool)
+{
+    NameKey key{resref};
+    if (!key.valid()) {
+        LOG_F(ERROR, "Invalid model resref: {}", resref);
+        return nullptr;
+    }
+
+    auto it = map_.find(key);
+    if (it != std::end(map_)) {
+        if (it->second.refcount_++ == 0) { unused_.erase(it->second.unused_); }
+        return &it->second;
+    }
+
+    // The resource manager is demanded on the worker too, under ``resman_mutex``, so the calling thread never
+    // waits on it
+    auto [entry, _] = map_.try_emplace(key);
+    auto payload = &entry->second;
+    payload->key_ = key;
+    payload->refcount_ = 1;
+    pool.enqueue([this, payload, key]() {
+        if (!prepare(*this, *payload, key)) {
+            payload->state_ = ModelLoadState::failed;
+            return;
+        }
+        payload->state_ = ModelLoadState::prepared;
+        std::lock_guard<std::mutex> lock(mutex_);
+        prepared_.push_back(payload);
+    });
+    return payload;
+}
+
+void ModelCache::release(std::string_view resref)
+{
+    auto it = map_.find(NameKey{resref});
+    if (it == std::end(map_) || it->second.refcount_ == 0) { return; }
+    if (--it->second.refcount_ == 0) {
+        it->second.unused_ = unused_.insert(unused_.end(), &it->second);
+    }
+}
+
+void ModelCache::update(std::chrono::microseconds budget)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        uploads_.insert(uploads_.end(), prepared_.begin(), prepared_.end());
+        prepared_.clear();
+    }
+
+    // At least one node is uploaded per frame, so a small budget can't stall loading
+    auto deadline = std::chrono::steady_clock::now() + budget;
+    while (!uploads_.empty()) {
+        auto payload = uploads_.front();
+        if (!payload->model_->upload(deadline)) { break; }
+        payload->state_ = ModelLoadState::ready;
+        payload->bytes_ = payload->model_->gpu_bytes_ + payload->model_->source_bytes();
+        bytes_ += payload->bytes_;
+        LOG_F(INFO, "Resref: {}", payload->key_.view());
+        uploads_.pop_front();
+        if (std::chrono::steady_clock::now() >= deadline) { break; }
+    }
+
+    evict();
+}
+
+void ModelCache::evict()
+{
+    auto it = unused_.begin();
+    while (bytes_ > budget_ && it != unused_.end()) {
+        auto payload = *it;
+        // Workers and the upload queue still point at models being loaded
+        auto state = payload->state_.load();
+        if (state == ModelLoadState::loading || state == ModelLoadState::prepared) {
+            ++it;
+            continue;
+        }
+
+        // Destroying the model destroys its buffers and releases its textures, the supermodels it animates
+        // from go after it
+        if (state == ModelLoadState::ready) { bytes_ -= payload->bytes_; }
+        auto supermodel = payload->supermodel_;
+        it = unused_.erase(it);
+        map_.erase(payload->key_);
+        release_supermodels(supermodel);
+    }
+}
+
+void ModelCache::clear()
+{
+    prepared_.clear();
+    uploads_.clear();
+    unused_.clear();
+    // Models go before the supermodels they animate from
+    map_.clear();
+    supermodels_.clear();
+    bytes_ = 0;
+}
+
+Supermodel* ModelCache::share_supermodels(const nw::model::Model& model)
+{
+    if (!model.supermodel) { return nullptr; }
+    NameKey key{model.supermodel_name};
+    if (!key.valid()) { return nullptr; }
+    {
+        std::lock_guard<std::mutex> lock(supermodel_mutex_);
+        auto it = supermodels_.find(key);
+        if (it != std::end(supermodels_)) {
+            ++it->second.refcount_;
+            return &it->second;
+        }
+    }
+
+    const auto& sm = model.supermodel->model;
+    auto parent = share_supermodels(sm);
+    auto animations = compile_animations(sm);
+
+    // A valid bake may be of the whole model, which has the same animations
+    BakedModel bake;
+    if (!bake_dir_.empty() && !open_bake(*this, key.view(), bake)) {
+        BakeSource source;
+        {
+            std::lock_guard<std::mutex> lock(resman_mutex());
+            source = bake_source(source_key(key.view()), sm);
+        }
+        if (source.key) { write_bake(bake_dir_, key.view(), *animations, source); }
+    }
+    return insert_supermodel(key, std::move(animations), parent);
+}
+
+Supermodel* ModelCache::acquire_supermodel(std::string_view name)
+{
+    NameKey key{name};
+    if (!key.valid()) { return nullptr; }
+    {
+        std::lock_guard<std::mutex> lock(supermodel_mutex_);
+        auto it = supermodels_.find(key);
+        if (it != std::end(supermodels_)) {
+            ++it->second.refcount_;
+            return &it->second;
+        }
+    }
+
+    BakedModel bake;
+    if (open_bake(*this, key.view(), bake)) {
+        auto names = bake.supermodels();
+        auto parent = names.empty() ? nullptr : acquire_supermodel(names.front());
+        if (names.empty() || parent) { return insert_supermodel(key, bake.animations(), parent); }
+    }
+
+    BakeSource source;
+    auto model = parse(*this, key.view(), source);
+    if (!model) { return nullptr; }
+    auto parent = share_supermodels(model->model);
+    auto animations = compile_animations(model->model);
+    if (source.key) { write_bake(bake_dir_, key.view(), *animations, source); }
+    return insert_supermodel(key, std::move(animations), parent);
+}
+
+Supermodel* ModelCache::insert_supermodel(NameKey key, std::unique_ptr<AnimationSet> animations, Supermodel* parent)
+{
+    Supermodel* result = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(supermodel_mutex_);
+        auto [it, inserted] = supermodels_.try_emplace(key);
+        result = &it->second;
+        if (inserted) {
+            result->key_ = key;
+            result->animations_ = std::move(animations);
+            result->parent_ = parent;
+            result->refcount_ = 1;
+            return result;
+        }
+        ++result->refcount_;
+    }
+
+    // The one added meanwhile holds its own reference to the chain
+    release_supermodels(parent);
+    return result;
+}
+
+void ModelCache::release_supermodels(Supermodel* supermodel)
+{
+    std::lock_guard<std::mutex> lock(supermodel_mutex_);
+    while (supermodel && --supermodel->refcount_ == 0) {
+        auto parent = supermodel->parent_;
+        supermodels_.erase(supermodel->key_);
+        supermodel = parent;
+    }
+}
@@ -1,20 +1,113 @@
 #pragma once
 
+#include "NameKey.hpp"
 #include "model.hpp"
 
-#include <absl/container/flat_hash_map.h>
+#include <absl/container/node_hash_map.h>
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <filesystem>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <vector>
+
+struct WorkerPool;
+
+enum struct ModelLoadState : uint8_t {
+    /// Parsing and preparing on a worker
+    loading,
+    /// Prepared, waiting for GPU resources to be created on the API thread
+    prepared,
+    ready,
+    failed,
+};
+
+/// Animations of a supermodel shared by every cached model inheriting from it
+struct Supermodel {
+    NameKey key_;
+    std::unique_ptr<AnimationSet> animations_;
+    /// Next supermodel in the chain
+    Supermodel* parent_ = nullptr;
+    /// Models and supermodels inheriting from this one
+    uint32_t refcount_ = 0;
+};
 
 struct ModelPayload {
+    NameKey key_;
     std::unique_ptr<Model> model_;
-    std::unique_ptr<nw::model::Mdl> original_;
+    /// Shared supermodel chain of ``model_``
+    Supermodel* supermodel_ = nullptr;
     uint32_t refcount_ = 0;
+    std::atomic<ModelLoadState> state_{ModelLoadState::loading};
+    /// Vertex and index buffer bytes plus source geometry still held, set once ready
+    size_t bytes_ = 0;
+    /// Position in ``ModelCache::unused_`` while ``refcount_`` is 0
+    std::list<ModelPayload*>::iterator unused_;
 };
 
 struct ModelCache {
     ModelCache() = default;
+
+    /// Loads a model, blocking until it's ready.  Returns nullptr on failure or if the model is still loading
+    /// asynchronously.
     Model* load(std::string_view resref);
 
-    std::unordered_map<std::string, ModelPayload> map_;
+    /// Starts loading a model on ``pool``, the returned payload is ready once ``state_`` is
+    /// ``ModelLoadState::ready``, or ``ModelLoadState::failed`` if the model doesn't exist or can't be parsed.
+    /// Returns nullptr if ``resref`` isn't a valid resref.
+    ModelPayload* load_async(std::string_view resref, WorkerPool& pool);
+
+    /// Drops a reference from ``load`` or ``load_async``, unreferenced models stay cached until evicted
+    void release(std::string_view resref);
+
+    /// Creates GPU resources of prepared models until ``budget`` is spent, then evicts.  Must be called every
+    /// frame on the API thread.
+    void update(std::chrono::microseconds budget);
+
+    /// Destroys least recently released models until ``bytes_`` is within ``budget_``
+    void evict();
+
+    /// Destroys all models and supermodels.  Models hold bgfx resources, so this must be called before
+    /// ``bgfx::shutdown``, with no load running on a worker.
+    void clear();
+
+    /// Compiles animations of the parsed supermodel chain of ``model`` into ``supermodels_``, reusing supermodels
+    /// already there and baking new ones.  Returns the nearest supermodel, with a reference added.  Thread safe.
+    Supermodel* share_supermodels(const nw::model::Model& model);
+
+    /// Gets a supermodel with a reference added, from ``supermodels_``, from any bake of it, or else by parsing it.
+    /// Returns nullptr if it can't be loaded.  Thread safe.
+    Supermodel* acquire_supermodel(std::string_view name);
+
+    /// Adds a supermodel taking over the reference to ``parent``, or adds a reference to the one another thread
+    /// added meanwhile.  Thread safe.
+    Supermodel* insert_supermodel(NameKey key, std::unique_ptr<AnimationSet> animations, Supermodel* parent);
+
+    /// Drops a reference from ``share_supermodels``, destroying supermodels no longer inherited from.
+    /// Thread safe.
+    void release_supermodels(Supermodel* supermodel);
+
+    /// Declared before ``map_`` so it outlives the models using it
+    absl::node_hash_map<NameKey, Supermodel> supermodels_;
+    std::mutex supermodel_mutex_;
+
+    absl::node_hash_map<NameKey, ModelPayload> map_;
+
+    /// Directory of baked models, see ``write_bake``.  Baking is disabled when empty.
+    std::filesystem::path bake_dir_;
+
+    /// Bytes of all ready models
+    size_t bytes_ = 0;
+    size_t budget_ = size_t(1024) * 1024 * 1024;
+    /// Unreferenced payloads, least recently released first
+    std::list<ModelPayload*> unused_;
+
+    /// Payloads prepared by workers, guarded by ``mutex_``
+    std::vector<ModelPayload*> prepared_;
+    std::mutex mutex_;
+    /// Payloads being uploaded, front first
+    std::deque<ModelPayload*> uploads_;
 };
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define MUDL_NAMEKEY_SSE2 1
+#endif
+
+/// A lowercase name of at most 16 characters stored inline with a precomputed hash, for allocation free lookups
+/// of resrefs and node names.  Longer names make an invalid key.
+struct NameKey {
+    static constexpr size_t max_size = 16;
+
+    NameKey() = default;
+    explicit NameKey(std::string_view name)
+    {
+        if (name.size() > max_size) { return; }
+        for (size_t i = 0; i < name.size(); ++i) {
+            char c = name[i];
+            data_[i] = c >= 'A' && c <= 'Z' ? char(c - 'A' + 'a') : c;
+        }
+        size_ = uint8_t(name.size());
+
+        // FNV-1a over both halves, the padding is always zero
+        uint64_t words[2];
+        std::memcpy(words, data_, sizeof(words));
+        uint64_t h = 14695981039346656037ull;
+        for (auto w : words) {
+            h = (h ^ w) * 1099511628211ull;
+            h ^= h >> 32;
+        }
+        hash_ = size_t(h);
+    }
+
+    /// Returns false for empty names and names that didn't fit
+    bool valid() const noexcept { return size_ != 0; }
+
+    std::string_view view() const noexcept { return {data_, size_}; }
+
+    size_t hash() const noexcept { return hash_; }
+
+    bool operator==(const NameKey& other) const noexcept
+    {
+#ifdef MUDL_NAMEKEY_SSE2
+        auto a = _mm_load_si128(reinterpret_cast<const __m128i*>(data_));
+        auto b = _mm_load_si128(reinterpret_cast<const __m128i*>(other.data_));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xffff;
+#else
+        return std::memcmp(data_, other.data_, max_size) == 0;
+#endif
+    }
+    bool operator!=(const NameKey& other) const noexcept { return !(*this == other); }
+
+    template <typename H>
+    friend H AbslHashValue(H h, const NameKey& key)
+    {
+        return H::combine(std::move(h), key.hash_);
+    }
+
+    alignas(16) char data_[max_size] = {};
+    size_t hash_ = 0;
+    uint8_t size_ = 0;
+};
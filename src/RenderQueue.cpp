@@ -0,0 +1,257 @@
+#include "RenderQueue.hpp"
+
+#include "WorkerPool.hpp"
+
+#include <nw/log.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <mutex>
+
+// Sort key layout, most significant first:
+//   view (8) | program (10) | state (6) | texture (12) | vertex buffer (12) | index buffer (12) | unused (4)
+inline uint64_t make_key(const RenderPacket& p, uint32_t state)
+{
+    return (uint64_t(p.view & 0xff) << 56)
+        | (uint64_t(p.program.idx & 0x3ff) << 46)
+        | (uint64_t(state & 0x3f) << 40)
+        | (uint64_t(p.texture.idx & 0xfff) << 28)
+        | (uint64_t(p.vbh.idx & 0xfff) << 16)
+        | (uint64_t(p.ibh.idx & 0xfff) << 4);
+}
+
+uint32_t RenderQueue::add_transform(const glm::mat4& mtx)
+{
+    transforms_.push_back(mtx);
+    return uint32_t(transforms_.size() - 1);
+}
+
+uint32_t RenderQueue::add_transforms(std::span<const glm::mat4> instances, const glm::mat4& local)
+{
+    auto result = uint32_t(transforms_.size());
+    for (const auto& mtx : instances) {
+        transforms_.push_back(mtx * local);
+    }
+    return result;
+}
+
+uint32_t RenderQueue::add_skin(const SkinBinding& skin)
+{
+    skins_.push_back(skin);
+    return uint32_t(skins_.size() - 1);
+}
+
+void RenderQueue::push(RenderPacket packet)
+{
+    auto it = std::find(std::begin(states_), std::end(states_), packet.state);
+    auto state = uint32_t(std::distance(std::begin(states_), it));
+    if (it == std::end(states_)) {
+        states_.push_back(packet.state);
+    }
+
+    packet.key = make_key(packet, state);
+    packets_.push_back(packet);
+}
+
+void RenderQueue::sort()
+{
+    const size_t n = packets_.size();
+    order_.resize(n);
+    scratch_.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        order_[i] = uint32_t(i);
+    }
+
+    // LSD radix sort of indices, one byte per pass
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::array<uint32_t, 256> counts{};
+        for (auto i : order_) {
+            ++counts[(packets_[i].key >> shift) & 0xff];
+        }
+        // All keys share this byte, nothing to reorder
+        if (std::find(std::begin(counts), std::end(counts), uint32_t(n)) != std::end(counts)) { continue; }
+
+        uint32_t offset = 0;
+        for (auto& count : counts) {
+            auto c = count;
+            count = offset;
+            offset += c;
+        }
+        for (auto i : order_) {
+            scratch_[counts[(packets_[i].key >> shift) & 0xff]++] = i;
+        }
+        std::swap(order_, scratch_);
+    }
+}
+
+namespace {
+
+struct Uniforms {
+    bgfx::UniformHandle s_texColor = bgfx::createUniform("s_texColor", bgfx::UniformType::Sampler);
+    bgfx::UniformHandle u_joints = bgfx::createUniform("u_joints", bgfx::UniformType::Mat4, max_uniform_joints);
+    bgfx::UniformHandle s_joints = bgfx::createUniform("s_joints", bgfx::UniformType::Sampler);
+    bgfx::UniformHandle u_skinPalette = bgfx::createUniform("u_skinPalette", bgfx::UniformType::Vec4);
+    bgfx::UniformHandle u_dequant = bgfx::createUniform("u_dequant", bgfx::UniformType::Vec4, 2);
+};
+
+// Created on first use, which must be on the API thread
+const Uniforms& uniforms()
+{
+    static Uniforms result;
+    return result;
+}
+
+void add_stats(RenderQueueStats& to, const RenderQueueStats& from)
+{
+    to.draws += from.draws;
+    to.state_binds += from.state_binds;
+    to.texture_binds += from.texture_binds;
+    to.buffer_binds += from.buffer_binds;
+    to.encoders += from.encoders;
+}
+
+} // namespace
+
+void RenderQueue::record(bgfx::Encoder* encoder, size_t begin, size_t end, RenderQueueStats& stats) const
+{
+    const auto& u = uniforms();
+    constexpr uint16_t stride = sizeof(glm::mat4);
+
+    // Bindings persist between draws, only transforms and instance data are discarded
+    constexpr uint8_t discard = BGFX_DISCARD_TRANSFORM | BGFX_DISCARD_INSTANCE_DATA;
+
+    const RenderPacket* prev = nullptr;
+    for (size_t i = begin; i < end; ++i) {
+        const auto& p = packets_[order_[i]];
+
+        if (!prev || prev->state != p.state) {
+            encoder->setState(p.state);
+            ++stats.state_binds;
+        }
+        if (!prev || prev->texture.idx != p.texture.idx) {
+            encoder->setTexture(0, u.s_texColor, p.texture, sampler_flags_);
+            ++stats.texture_binds;
+        }
+        if (!prev || prev->vbh.idx != p.vbh.idx || prev->first_vertex != p.first_vertex
+            || prev->num_vertices != p.num_vertices) {
+            encoder->setVertexBuffer(0, p.vbh, p.first_vertex, p.num_vertices);
+            ++stats.buffer_binds;
+        }
+        if (!prev || prev->ibh.idx != p.ibh.idx || prev->first_index != p.first_index
+            || prev->num_indices != p.num_indices) {
+            encoder->setIndexBuffer(p.ibh, p.first_index, p.num_indices);
+            ++stats.buffer_binds;
+        }
+        // bgfx may reorder draws within a view, so uniforms are set for every skinned draw
+        if (p.skin != RenderPacket::no_skin) {
+            const auto& skin = skins_[p.skin];
+            encoder->setUniform(u.u_dequant, skin.dequant, 2);
+            if (bgfx::isValid(skin.palette)) {
+                encoder->setTexture(1, u.s_joints, skin.palette);
+                encoder->setUniform(u.u_skinPalette, &skin.params);
+            } else if (skin.num_joints) {
+                encoder->setUniform(u.u_joints, skin.joints, std::min(skin.num_joints, max_uniform_joints));
+            }
+        }
+        prev = &p;
+
+        if (p.num_instances <= 1) {
+            encoder->setTransform(&transforms_[p.transform][0][0]);
+            encoder->submit(p.view, p.program, 0, discard);
+            ++stats.draws;
+            continue;
+        }
+
+        // Instances past the end of the frame's buffer were dropped by ``allocate_instances``
+        uint32_t first = instance_offsets_[i];
+        uint32_t count = first < instances_.num ? std::min(p.num_instances, instances_.num - first) : 0;
+        if (count == 0) { continue; }
+        std::memcpy(instances_.data + size_t(first) * stride, &transforms_[p.transform], count * sizeof(glm::mat4));
+        encoder->setInstanceDataBuffer(&instances_, first, count);
+        encoder->submit(p.view, p.program, 0, discard);
+        ++stats.draws;
+    }
+
+    encoder->discard();
+    ++stats.encoders;
+}
+
+void RenderQueue::allocate_instances()
+{
+    constexpr uint16_t stride = sizeof(glm::mat4);
+
+    instance_offsets_.resize(order_.size());
+    uint32_t total = 0;
+    for (size_t i = 0; i < order_.size(); ++i) {
+        instance_offsets_[i] = total;
+        const auto& p = packets_[order_[i]];
+        if (p.num_instances > 1) { total += p.num_instances; }
+    }
+
+    instances_ = {};
+    if (total == 0) { return; }
+    uint32_t count = bgfx::getAvailInstanceDataBuffer(total, stride);
+    if (count < total) {
+        LOG_F(WARNING, "Instance data buffer exhausted, dropped instances: {}", total - count);
+    }
+    if (count) { bgfx::allocInstanceDataBuffer(&instances_, count, stride); }
+}
+
+void RenderQueue::submit(WorkerPool* pool)
+{
+    uniforms();
+    if (order_.size() != packets_.size()) { sort(); }
+    allocate_instances();
+
+    // The API thread's own encoder counts against the limit, workers get the rest
+    const size_t max_encoders = std::max(bgfx::getCaps()->limits.maxEncoders, uint32_t(1));
+    size_t encoders = pool ? std::min(max_encoders - 1, pool->size() + 1) : 0;
+    encoders = std::min(encoders, order_.size() / min_draws_per_encoder);
+
+    if (encoders <= 1) {
+        auto encoder = bgfx::begin();
+        record(encoder, 0, order_.size(), stats_);
+        bgfx::end(encoder);
+        return;
+    }
+
+    // Each chunk records through its own encoder, so ``parallel_for`` must not split into more chunks than
+    // there are encoders.  Chunks that can't get one are recorded after on this thread.
+    std::mutex mutex;
+    std::vector<std::pair<size_t, size_t>> deferred;
+    size_t grain = (order_.size() + encoders - 1) / encoders;
+    pool->parallel_for(order_.size(), grain, [&](size_t begin, size_t end) {
+        auto encoder = bgfx::begin(true);
+        if (!encoder) {
+            std::lock_guard<std::mutex> lock(mutex);
+            deferred.emplace_back(begin, end);
+            return;
+        }
+
+        RenderQueueStats stats;
+        record(encoder, begin, end, stats);
+        bgfx::end(encoder);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        add_stats(stats_, stats);
+    });
+
+    for (auto [begin, end] : deferred) {
+        auto encoder = bgfx::begin();
+        record(encoder, begin, end, stats_);
+        bgfx::end(encoder);
+    }
+}
+
+void RenderQueue::clear()
+{
+    packets_.clear();
+    transforms_.clear();
+    skins_.clear();
+    states_.clear();
+    order_.clear();
+    instance_offsets_.clear();
+    instances_ = {};
+    stats_ = {};
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <bgfx/bgfx.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/// Size of the ``u_joints`` array of the uniform skinning shaders.  Only renderers without RGBA32F vertex
+/// textures fall back to it, so only there a skin is limited to this many bones.  MDL skins reference at most
+/// 64 bones each, see ``nw::model::SkinNode::bone_nodes``, so no model exceeds it today.
+constexpr uint16_t max_uniform_joints = 64;
+
+/// Joint palette a skinned draw reads from, either the palette texture or ``num_joints`` uniforms
+struct SkinBinding {
+    bgfx::TextureHandle palette = BGFX_INVALID_HANDLE;
+    /// x: first palette row, y: 1 / palette rows, see ``vs_skin_palette_mudl.sc``
+    glm::vec4 params{0.0f};
+    const glm::mat4* joints = nullptr;
+    uint16_t num_joints = 0;
+    /// Position offset and scale of the packed skin vertices, see ``Dequantize``
+    glm::vec4 dequant[2];
+};
+
+/// A single draw, drawn instanced when ``num_instances`` > 1
+struct RenderPacket {
+    uint64_t key = 0;
+    bgfx::ViewId view = 0;
+    bgfx::ProgramHandle program = BGFX_INVALID_HANDLE;
+    bgfx::TextureHandle texture = BGFX_INVALID_HANDLE;
+    bgfx::VertexBufferHandle vbh = BGFX_INVALID_HANDLE;
+    bgfx::IndexBufferHandle ibh = BGFX_INVALID_HANDLE;
+    /// Range of ``vbh`` and ``ibh``, the whole buffers by default
+    uint32_t first_vertex = 0;
+    uint32_t num_vertices = UINT32_MAX;
+    uint32_t first_index = 0;
+    uint32_t num_indices = UINT32_MAX;
+    uint64_t state = 0;
+    /// Index of first transform in ``RenderQueue::transforms_``
+    uint32_t transform = 0;
+    uint32_t num_instances = 1;
+    /// Index into ``RenderQueue::skins_``, or ``no_skin``
+    uint32_t skin = no_skin;
+
+    static constexpr uint32_t no_skin = UINT32_MAX;
+};
+
+struct RenderQueueStats {
+    uint32_t draws = 0;
+    uint32_t state_binds = 0;
+    uint32_t texture_binds = 0;
+    uint32_t buffer_binds = 0;
+    /// Encoders draws were recorded through
+    uint32_t encoders = 0;
+};
+
+struct WorkerPool;
+
+/// Collects draws for a frame, sorts them by GPU state and submits them in order, only binding what changed
+/// between consecutive draws.  Nothing but ``submit`` calls into bgfx.
+struct RenderQueue {
+    /// Fewest draws worth recording through an extra encoder
+    static constexpr size_t min_draws_per_encoder = 256;
+
+    /// Adds a transform, returns its index
+    uint32_t add_transform(const glm::mat4& mtx);
+
+    /// Adds ``instance * local`` for every instance, returns index of the first
+    uint32_t add_transforms(std::span<const glm::mat4> instances, const glm::mat4& local);
+
+    /// Adds a skin binding, returns its index
+    uint32_t add_skin(const SkinBinding& skin);
+
+    /// Adds a draw, computing its sort key
+    void push(RenderPacket packet);
+
+    /// Sorts draws by key, stable for draws with equal keys
+    void sort();
+
+    /// Submits sorted draws to bgfx from the API thread.  If ``pool`` is not null, sorted draws are split into
+    /// contiguous ranges recorded in parallel, each through its own encoder, up to ``bgfx::Init::limits.maxEncoders``.
+    void submit(WorkerPool* pool = nullptr);
+
+    /// Allocates instance data of all instanced draws in one buffer.  Encoders recording in parallel only fill
+    /// their slices of it, since checking for space and allocating from several threads could race.
+    void allocate_instances();
+
+    /// Records sorted draws ``[begin, end)`` through ``encoder``, after ``allocate_instances``
+    void record(bgfx::Encoder* encoder, size_t begin, size_t end, RenderQueueStats& stats) const;
+
+    /// Clears all draws, keeping allocations
+    void clear();
+
+    std::vector<RenderPacket> packets_;
+    std::vector<glm::mat4> transforms_;
+    std::vector<SkinBinding> skins_;
+    /// Distinct render states of this frame, their index is part of the sort key
+    std::vector<uint64_t> states_;
+    /// Draw order after ``sort``
+    std::vector<uint32_t> order_;
+    std::vector<uint32_t> scratch_;
+    /// Instance data of this frame, and the first instance of each sorted draw in it
+    bgfx::InstanceDataBuffer instances_{};
+    std::vector<uint32_t> instance_offsets_;
+    RenderQueueStats stats_;
+    /// Sampler flags of the color texture, ``UINT32_MAX`` uses those the texture was created with
+    uint32_t sampler_flags_ = UINT32_MAX;
+};
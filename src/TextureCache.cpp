@@ -1,7 +1,84 @@
 #include "TextureCache.hpp"
 
+#include "WorkerPool.hpp"
+#include "mipmap.hpp"
+#include "util.hpp"
+
 #include <nw/kernel/Resources.hpp>
 
+#include <algorithm>
+#include <array>
+
+// Decodes an image without touching bgfx, so it can run on any thread.  Block compressed DDS files in a format
+// in ``supported`` skip decoding and are uploaded as stored.
+static bool decode(TexturePayload& payload, nw::ResourceData&& rd, std::span<const bgfx::TextureFormat::Enum> supported,
+    bool mips)
+{
+    auto data = std::make_unique<TextureData>();
+
+    DdsImage dds;
+    if (rd.name.type == nw::ResourceType::dds && parse_dds({rd.bytes.data(), rd.bytes.size()}, dds)
+        && std::find(supported.begin(), supported.end(), dds.format) != supported.end()) {
+        data->format = dds.format;
+        data->width = dds.width;
+        data->height = dds.height;
+        data->has_mips = dds.mips > 1;
+        data->bytes = std::move(rd.bytes);
+        data->pixels = data->bytes.data() + dds.offset;
+        data->size = uint32_t(dds.size);
+    } else {
+        auto resref = std::string(rd.name.resref.view());
+        auto type = int(rd.name.type);
+        auto img = std::make_unique<nw::Image>(std::move(rd));
+        if (!img->valid()) {
+            LOG_F(ERROR, "Failed to load image: {} of type: {}", resref, type);
+            return false;
+        }
+        data->format = img->channels() == 4 ? bgfx::TextureFormat::RGBA8 : bgfx::TextureFormat::RGB8;
+        data->width = img->width();
+        data->height = img->height();
+        if (mips) { data->mips = generate_mips(img->data(), img->width(), img->height(), img->channels()); }
+        if (data->mips.size()) {
+            // The top level is part of the chain, so the image can go now
+            data->has_mips = true;
+            data->pixels = data->mips.data();
+            data->size = uint32_t(data->mips.size());
+        } else {
+            data->pixels = img->data();
+            data->size = img->channels() * img->height() * img->width();
+            data->image = std::move(img);
+        }
+    }
+
+    payload.cpu_bytes_ = data->size;
+    payload.data_ = std::move(data);
+    return true;
+}
+
+// Finds a texture, DDS first
+static nw::ResourceData demand(std::string_view resref)
+{
+    std::lock_guard<std::mutex> lock(resman_mutex());
+    auto result = nw::kernel::resman().demand_in_order(resref, {nw::ResourceType::dds, nw::ResourceType::tga});
+    if (result.bytes.size() == 0) {
+        LOG_F(ERROR, "Failed to find texture: {} of type: {}", resref, int(result.name.type));
+    }
+    return result;
+}
+
+// Hands decoded data to bgfx, which frees it once it's been copied to the GPU
+static void upload(TexturePayload& payload)
+{
+    auto data = payload.data_.release();
+    auto mem = bgfx::makeRef(
+        data->pixels, data->size, [](void*, void* user) { delete static_cast<TextureData*>(user); }, data);
+    payload.handle_ = bgfx::createTexture2D(uint16_t(data->width), uint16_t(data->height), data->has_mips, 1,
+        data->format, BGFX_TEXTURE_NONE | BGFX_SAMPLER_NONE, mem);
+    payload.gpu_bytes_ = payload.cpu_bytes_;
+    payload.cpu_bytes_ = 0;
+    payload.state_ = TextureLoadState::ready;
+}
+
 void TextureCache::load_placeholder()
 {
     place_holder_image_ = std::make_unique<nw::Image>("assets/templategrid_albedo.png");
@@ -14,37 +91,133 @@ void TextureCache::load_placeholder()
         BGFX_TEXTURE_NONE | BGFX_SAMPLER_NONE, mem);
 
     place_holder_ = handle;
+
+    auto caps = bgfx::getCaps();
+    bc1_supported_ = caps->formats[bgfx::TextureFormat::BC1] & BGFX_CAPS_FORMAT_TEXTURE_2D;
+    bc3_supported_ = caps->formats[bgfx::TextureFormat::BC3] & BGFX_CAPS_FORMAT_TEXTURE_2D;
+    LOG_F(INFO, "Block compressed textures, BC1: {}, BC3: {}", bc1_supported_, bc3_supported_);
+}
+
+TexturePayload* TextureCache::acquire(std::string_view resref)
+{
+    NameKey key{resref};
+    if (!key.valid()) {
+        LOG_F(ERROR, "Invalid texture resref: {}", resref);
+        return nullptr;
+    }
+
+    auto it = map_.find(key);
+    if (it != std::end(map_)) {
+        if (it->second.refcount_++ == 0) { unused_.erase(it->second.unused_); }
+        return &it->second;
+    }
+
+    // Missing textures are cached too, so they're only searched for once
+    auto payload = &map_[key];
+    payload->key_ = key;
+    payload->handle_ = place_holder_;
+    payload->refcount_ = 1;
+
+    std::array<bgfx::TextureFormat::Enum, 2> formats;
+    size_t num_formats = 0;
+    if (bc1_supported_) { formats[num_formats++] = bgfx::TextureFormat::BC1; }
+    if (bc3_supported_) { formats[num_formats++] = bgfx::TextureFormat::BC3; }
+    std::span<const bgfx::TextureFormat::Enum> supported{formats.data(), num_formats};
+
+    if (!pool_) {
+        auto rd = demand(resref);
+        if (rd.bytes.size() && decode(*payload, std::move(rd), supported, generate_mips_)) {
+            upload(*payload);
+            gpu_bytes_ += payload->gpu_bytes_;
+        } else {
+            payload->state_ = TextureLoadState::failed;
+        }
+        return payload;
+    }
+
+    // The resource manager is demanded on the worker too, under ``resman_mutex``, so the calling thread never
+    // waits on a model being parsed
+    pool_->enqueue([this, payload, key, formats, num_formats, mips = generate_mips_]() {
+        auto rd = demand(key.view());
+        if (rd.bytes.size() == 0 || !decode(*payload, std::move(rd), {formats.data(), num_formats}, mips)) {
+            payload->state_ = TextureLoadState::failed;
+            return;
+        }
+        payload->state_ = TextureLoadState::decoded;
+        std::lock_guard<std::mutex> lock(mutex_);
+        decoded_.push_back(payload);
+    });
+    return payload;
 }
 
-std::optional<bgfx::TextureHandle> TextureCache::load(std::string_view resref)
+void TextureCache::release(TexturePayload* payload)
 {
-    absl::string_view needle{resref.data(), resref.size()};
-    auto it = map_.find(needle);
-    if (it == std::end(map_)) {
-        // Create
-        auto rd = nw::kernel::resman().demand_in_order(resref, {nw::ResourceType::dds, nw::ResourceType::tga});
-        if (rd.bytes.size() == 0) {
-            LOG_F(ERROR, "Failed to find texture: {} of type: {}", resref, int(rd.name.type));
-            return place_holder_;
+    if (!payload || payload->refcount_ == 0) { return; }
+    if (--payload->refcount_ == 0) {
+        payload->unused_ = unused_.insert(unused_.end(), payload);
+    }
+}
+
+void TextureCache::update(size_t budget)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto payload : decoded_) {
+            cpu_bytes_ += payload->cpu_bytes_;
         }
-        auto img = std::make_unique<nw::Image>(std::move(rd));
-        if (!img->valid()) {
-            LOG_F(ERROR, "Failed to load image: {} of type: {}", resref, int(rd.name.type));
-            return place_holder_;
+        uploads_.insert(uploads_.end(), decoded_.begin(), decoded_.end());
+        decoded_.clear();
+    }
+
+    size_t uploaded = 0;
+    while (!uploads_.empty() && (uploaded == 0 || uploaded + uploads_.front()->cpu_bytes_ <= budget)) {
+        auto payload = uploads_.front();
+        uploads_.pop_front();
+        uploaded += payload->cpu_bytes_;
+        cpu_bytes_ -= payload->cpu_bytes_;
+        upload(*payload);
+        gpu_bytes_ += payload->gpu_bytes_;
+    }
+
+    evict();
+}
+
+void TextureCache::clear()
+{
+    decoded_.clear();
+    uploads_.clear();
+    unused_.clear();
+    for (auto& [_, payload] : map_) {
+        if (bgfx::isValid(payload.handle_) && payload.handle_.idx != place_holder_.idx) {
+            bgfx::destroy(payload.handle_);
         }
+    }
+    map_.clear();
+    if (bgfx::isValid(place_holder_)) {
+        bgfx::destroy(place_holder_);
+        place_holder_ = BGFX_INVALID_HANDLE;
+    }
+    cpu_bytes_ = 0;
+    gpu_bytes_ = 0;
+}
 
-        auto size = img->channels() * img->height() * img->width();
-        auto mem = bgfx::makeRef(img->data(), size);
-        auto handle = bgfx::createTexture2D(uint16_t(img->width()), uint16_t(img->height()), false, 1,
-            img->channels() == 4 ? bgfx::TextureFormat::RGBA8 : bgfx::TextureFormat::RGB8,
-            BGFX_TEXTURE_NONE | BGFX_SAMPLER_NONE, mem);
+void TextureCache::evict()
+{
+    auto it = unused_.begin();
+    while (cpu_bytes_ + gpu_bytes_ > budget_ && it != unused_.end()) {
+        auto payload = *it;
+        // Workers and the upload queue still point at textures being loaded
+        auto state = payload->state_.load();
+        if (state == TextureLoadState::loading || state == TextureLoadState::decoded) {
+            ++it;
+            continue;
+        }
 
-        map_.insert({std::string(resref), TexturePayload{std::move(img), handle, 1}});
-        return handle;
-    } else {
-        ++it->second.refcount_;
-        return it->second.handle_;
+        if (bgfx::isValid(payload->handle_) && payload->handle_.idx != place_holder_.idx) {
+            bgfx::destroy(payload->handle_);
+        }
+        gpu_bytes_ -= payload->gpu_bytes_;
+        it = unused_.erase(it);
+        map_.erase(payload->key_);
     }
-    // Failure
-    return {};
 }
@@ -1,24 +1,110 @@
 #pragma once
 
-#include <absl/container/flat_hash_map.h>
+#include "NameKey.hpp"
+#include "dds.hpp"
+
+#include <absl/container/node_hash_map.h>
 #include <bgfx/bgfx.h>
 #include <nw/legacy/Image.hpp>
 #include <nw/resources/ResourceType.hpp>
 
-#include <optional>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct WorkerPool;
+
+enum struct TextureLoadState : uint8_t {
+    /// Decoding on a worker
+    loading,
+    /// Decoded, waiting for upload on the API thread
+    decoded,
+    ready,
+    failed,
+};
+
+/// Decoded texture data, owned by bgfx from upload until it's done reading ``pixels``
+struct TextureData {
+    bgfx::TextureFormat::Enum format = bgfx::TextureFormat::Unknown;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    bool has_mips = false;
+    /// All levels to upload, points into one of the below
+    const uint8_t* pixels = nullptr;
+    uint32_t size = 0;
+
+    std::unique_ptr<nw::Image> image;
+    /// File contents of a block compressed DDS uploaded as is
+    nw::ByteArray bytes;
+    /// Full mip chain generated from ``image``
+    std::vector<uint8_t> mips;
+};
 
 struct TexturePayload {
-    std::unique_ptr<nw::Image> image_;
-    bgfx::TextureHandle handle_;
+    NameKey key_;
+    /// Set between decode and upload
+    std::unique_ptr<TextureData> data_;
+    /// The placeholder until the texture is uploaded
+    bgfx::TextureHandle handle_ = BGFX_INVALID_HANDLE;
     uint32_t refcount_ = 0;
+    std::atomic<TextureLoadState> state_{TextureLoadState::loading};
+    /// Size of ``data_``, and of the texture once uploaded
+    size_t cpu_bytes_ = 0;
+    size_t gpu_bytes_ = 0;
+    /// Position in ``TextureCache::unused_`` while ``refcount_`` is 0
+    std::list<TexturePayload*>::iterator unused_;
 };
 
 struct TextureCache {
     void load_placeholder();
 
-    std::optional<bgfx::TextureHandle> load(std::string_view resref);
-    absl::flat_hash_map<std::string, TexturePayload> map_;
+    /// Gets a reference to a texture, if ``pool_`` is set it's decoded there and the payload holds the
+    /// placeholder until ``update`` uploads it.  Missing textures keep the placeholder, only resrefs too long
+    /// to be valid return nullptr.
+    TexturePayload* acquire(std::string_view resref);
+
+    /// Drops a reference from ``acquire``, unreferenced textures stay cached until evicted
+    void release(TexturePayload* payload);
 
-    bgfx::TextureHandle place_holder_;
+    /// Uploads decoded textures until ``budget`` bytes have been uploaded this frame, at least one is uploaded
+    /// if any is waiting, then evicts.  Must be called every frame on the API thread.
+    void update(size_t budget);
+
+    /// Destroys least recently released textures until ``cpu_bytes_ + gpu_bytes_`` is within ``budget_``
+    void evict();
+
+    /// Destroys all textures and the placeholder.  Must be called before ``bgfx::shutdown``, after models are
+    /// cleared and with no decode running on a worker.
+    void clear();
+
+    /// Payloads are referenced by meshes, so they must not move
+    absl::node_hash_map<NameKey, TexturePayload> map_;
+
+    bgfx::TextureHandle place_holder_ = BGFX_INVALID_HANDLE;
     std::unique_ptr<nw::Image> place_holder_image_;
+
+    /// Set for block compressed formats the renderer can sample, see ``load_placeholder``
+    bool bc1_supported_ = false;
+    bool bc3_supported_ = false;
+
+    /// Generates mips of decoded textures, block compressed ones use the levels they store
+    bool generate_mips_ = true;
+
+    /// Bytes of decoded data waiting for upload and of uploaded textures, excluding the placeholder
+    size_t cpu_bytes_ = 0;
+    size_t gpu_bytes_ = 0;
+    size_t budget_ = size_t(512) * 1024 * 1024;
+    /// Unreferenced payloads, least recently released first
+    std::list<TexturePayload*> unused_;
+
+    /// Decodes textures if set, otherwise ``acquire`` blocks
+    WorkerPool* pool_ = nullptr;
+    /// Payloads decoded by workers, guarded by ``mutex_``
+    std::vector<TexturePayload*> decoded_;
+    std::mutex mutex_;
+    /// Payloads waiting for upload, front first
+    std::deque<TexturePayload*> uploads_;
 };
@@ -0,0 +1,112 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+WorkerPool::WorkerPool(size_t threads)
+{
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back([this] {
+            while (true) {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+                    if (jobs_.empty()) { return; }
+                    job = std::move(jobs_.front());
+                    jobs_.pop_front();
+                    ++running_;
+                }
+                job();
+                // Captures are released before the job counts as done
+                job = nullptr;
+
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--running_ == 0 && jobs_.empty()) { idle_cv_.notify_all(); }
+            }
+        });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void WorkerPool::enqueue(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+}
+
+void WorkerPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [this] { return running_ == 0 && jobs_.empty(); });
+}
+
+struct ParallelForState {
+    std::function<void(size_t, size_t)> fn;
+    size_t count = 0;
+    size_t chunk = 0;
+    size_t num_chunks = 0;
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+inline void run_chunks(ParallelForState& state)
+{
+    size_t c;
+    while ((c = state.next.fetch_add(1)) < state.num_chunks) {
+        size_t begin = c * state.chunk;
+        state.fn(begin, std::min(begin + state.chunk, state.count));
+        if (state.done.fetch_add(1) + 1 == state.num_chunks) {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.cv.notify_all();
+        }
+    }
+}
+
+void WorkerPool::parallel_for(size_t count, size_t grain, std::function<void(size_t, size_t)> fn)
+{
+    if (count == 0) { return; }
+
+    grain = std::max(grain, size_t(1));
+    size_t num_chunks = std::min(threads_.size() + 1, (count + grain - 1) / grain);
+    if (num_chunks <= 1) {
+        fn(0, count);
+        return;
+    }
+
+    // Shared, since workers may only get to their job after all chunks are done
+    auto state = std::make_shared<ParallelForState>();
+    state->fn = std::move(fn);
+    state->count = count;
+    state->chunk = (count + num_chunks - 1) / num_chunks;
+    state->num_chunks = (count + state->chunk - 1) / state->chunk;
+
+    for (size_t i = 1; i < state->num_chunks; ++i) {
+        enqueue([state] { run_chunks(*state); });
+    }
+    run_chunks(*state);
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait(lock, [&state] { return state->done.load() == state->num_chunks; });
+}
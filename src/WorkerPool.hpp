@@ -0,0 +1,38 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WorkerPool {
+    /// Starts ``threads`` workers, if 0 one less than the number of hardware threads
+    explicit WorkerPool(size_t threads = 0);
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool();
+
+    /// Queues a job to run on a worker thread
+    void enqueue(std::function<void()> job);
+
+    /// Blocks until no job is queued or running
+    void wait();
+
+    /// Calls ``fn(begin, end)`` over ``[0, count)`` in chunks of at least ``grain`` items.  The calling
+    /// thread takes part, so this never waits on workers busy with other jobs to start.
+    void parallel_for(size_t count, size_t grain, std::function<void(size_t, size_t)> fn);
+
+    /// Number of worker threads
+    size_t size() const noexcept { return threads_.size(); }
+
+    std::vector<std::thread> threads_;
+    std::deque<std::function<void()>> jobs_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    /// Jobs being run, guarded by ``mutex_``
+    size_t running_ = 0;
+    std::condition_variable idle_cv_;
+    bool stop_ = false;
+};
@@ -0,0 +1,72 @@
+#include "animation.hpp"
+
+#include <glm/gtx/quaternion.hpp>
+
+#include <algorithm>
+
+// Number of keys the cursor is allowed to walk forward before giving up and doing a binary search.
+constexpr size_t linear_search_limit = 4;
+
+size_t find_key(std::span<const float> times, float t, TrackCursor& cursor)
+{
+    if (times.size() < 2 || t <= times[0]) {
+        cursor.key = 0;
+        return 0;
+    }
+
+    size_t i = std::min(cursor.key, times.size() - 1);
+    if (times[i] <= t) {
+        for (size_t step = 0; step < linear_search_limit && i + 1 < times.size(); ++step) {
+            if (t < times[i + 1]) {
+                cursor.key = i;
+                return i;
+            }
+            ++i;
+        }
+        if (i + 1 >= times.size()) {
+            cursor.key = i;
+            return i;
+        }
+    }
+
+    auto it = std::upper_bound(times.begin(), times.end(), t);
+    cursor.key = size_t(std::distance(times.begin(), it)) - 1;
+    return cursor.key;
+}
+
+inline float key_factor(std::span<const float> times, size_t key, float t)
+{
+    if (key + 1 >= times.size()) { return 0.0f; }
+    float span = times[key + 1] - times[key];
+    if (span <= 0.0f) { return 0.0f; }
+    return std::clamp((t - times[key]) / span, 0.0f, 1.0f);
+}
+
+glm::vec3 sample_position(AnimationTrack& track, float t)
+{
+    auto data = track.data;
+    auto times = track.time.first(std::min(track.time.size(), data.size() / 3));
+    if (times.empty()) { return glm::vec3{0.0f}; }
+
+    size_t key = find_key(times, t, track.cursor);
+    glm::vec3 start{data[key * 3], data[key * 3 + 1], data[key * 3 + 2]};
+    if (key + 1 >= times.size()) { return start; }
+
+    glm::vec3 end{data[key * 3 + 3], data[key * 3 + 4], data[key * 3 + 5]};
+    return glm::mix(start, end, key_factor(times, key, t));
+}
+
+glm::quat sample_orientation(AnimationTrack& track, float t)
+{
+    auto data = track.data;
+    auto times = track.time.first(std::min(track.time.size(), data.size() / 4));
+    if (times.empty()) { return glm::quat{}; }
+
+    // NWN stores orientation keys as x, y, z, w
+    size_t key = find_key(times, t, track.cursor);
+    glm::quat start{data[key * 4 + 3], data[key * 4], data[key * 4 + 1], data[key * 4 + 2]};
+    if (key + 1 >= times.size()) { return start; }
+
+    glm::quat end{data[key * 4 + 7], data[key * 4 + 4], data[key * 4 + 5], data[key * 4 + 6]};
+    return glm::slerp(start, end, key_factor(times, key, t));
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+/// Cached key index of a single animation track, so that sampling during normal
+/// playback doesn't have to search the track from the beginning every frame.
+struct TrackCursor {
+    size_t key = 0;
+};
+
+/// A keyed controller of an animation node along with its playback cursor
+struct AnimationTrack {
+    std::span<const float> time;
+    std::span<const float> data;
+    TrackCursor cursor;
+};
+
+/// An animation node compiled against the model node it drives
+struct AnimationBinding {
+    uint32_t node = 0;
+    AnimationTrack position;
+    AnimationTrack orientation;
+};
+
+/// Keyed position and orientation of one node of an animation, by node name
+struct AnimationNode {
+    std::string name;
+    AnimationTrack position;
+    AnimationTrack orientation;
+};
+
+/// An animation compiled from an MDL, its tracks point into the keys of the ``AnimationSet`` owning it
+struct Animation {
+    std::string name;
+    float length = 0.0f;
+    /// Nodes with position or orientation keys
+    std::vector<AnimationNode> nodes;
+};
+
+/// Animations of one model, without those of its supermodels.  Not copyable, since tracks point into ``keys``.
+struct AnimationSet {
+    AnimationSet() = default;
+    AnimationSet(const AnimationSet&) = delete;
+    AnimationSet& operator=(const AnimationSet&) = delete;
+
+    std::vector<Animation> animations;
+    /// Key times and values of all tracks
+    std::vector<float> keys;
+};
+
+/// Finds the index of the last key with a time <= `t`.  Playback moving forward by a few
+/// keys advances the cursor linearly, anything else (looping, scrubbing, seeking) falls
+/// back to a binary search.
+size_t find_key(std::span<const float> times, float t, TrackCursor& cursor);
+
+/// Samples a position track, linearly interpolating between neighbouring keys
+glm::vec3 sample_position(AnimationTrack& track, float t);
+
+/// Samples an orientation track, spherically interpolating between neighbouring keys
+glm::quat sample_orientation(AnimationTrack& track, float t);
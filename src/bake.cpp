@@ -0,0 +1,379 @@
+#include "bake.hpp"
+
+#include "model.hpp"
+
+#include <nw/log.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <system_error>
+#include <vector>
+
+namespace {
+
+constexpr const char* bake_extension = ".bake";
+
+// Appends arrays to a file image, each aligned for any element type
+struct BakeWriter {
+    std::vector<uint8_t> bytes;
+
+    template <typename T>
+    uint64_t append(std::span<const T> data)
+    {
+        bytes.resize((bytes.size() + 15) & ~size_t(15));
+        uint64_t result = bytes.size();
+        auto src = reinterpret_cast<const uint8_t*>(data.data());
+        bytes.insert(bytes.end(), src, src + data.size_bytes());
+        return result;
+    }
+
+    BakedString append_string(std::string_view str)
+    {
+        return {append(std::span<const char>(str)), str.size()};
+    }
+};
+
+bool in_file(const MappedFile& file, uint64_t offset, uint64_t count, size_t size)
+{
+    if (offset % 16 != 0 || offset > file.size_) { return false; }
+    return count <= (file.size_ - offset) / size;
+}
+
+bool in_file(const MappedFile& file, const BakedString& str)
+{
+    return in_file(file, str.offset, str.size, 1);
+}
+
+// Starts a file image with room for the header
+BakeHeader begin_bake(BakeWriter& writer, const BakeSource& source)
+{
+    BakeHeader result;
+    result.source_key = source.key;
+    result.chain_key = source.chain_key;
+    result.options_hash = bake_options_hash();
+    writer.bytes.resize(sizeof(BakeHeader));
+
+    std::vector<BakedString> supermodels;
+    for (const auto& name : source.supermodels) {
+        supermodels.push_back(writer.append_string(name));
+    }
+    result.supermodels_offset = writer.append(std::span<const BakedString>(supermodels));
+    result.num_supermodels = uint32_t(supermodels.size());
+    return result;
+}
+
+void append_animations(BakeWriter& writer, BakeHeader& header, const AnimationSet& set)
+{
+    // Tracks point into the set's keys
+    auto track = [&set](const AnimationTrack& t) {
+        BakedTrack result;
+        if (t.time.size()) { result.time_offset = uint32_t(t.time.data() - set.keys.data()); }
+        result.time_count = uint32_t(t.time.size());
+        if (t.data.size()) { result.data_offset = uint32_t(t.data.data() - set.keys.data()); }
+        result.data_count = uint32_t(t.data.size());
+        return result;
+    };
+
+    std::vector<BakedAnimation> animations;
+    std::vector<BakedAnimationNode> nodes;
+    for (const auto& anim : set.animations) {
+        BakedAnimation baked;
+        baked.name = writer.append_string(anim.name);
+        baked.length = anim.length;
+        baked.first_node = nodes.size();
+        baked.num_nodes = uint32_t(anim.nodes.size());
+        for (const auto& node : anim.nodes) {
+            nodes.push_back({writer.append_string(node.name), track(node.position), track(node.orientation)});
+        }
+        animations.push_back(baked);
+    }
+
+    header.keys_offset = writer.append(std::span<const float>(set.keys));
+    header.num_keys = set.keys.size();
+    header.animation_nodes_offset = writer.append(std::span<const BakedAnimationNode>(nodes));
+    header.num_animation_nodes = nodes.size();
+    header.animations_offset = writer.append(std::span<const BakedAnimation>(animations));
+    header.num_animations = animations.size();
+}
+
+// Writes a finished file image through a temporary file
+bool finish_bake(const std::filesystem::path& dir, std::string_view resref, BakeWriter& writer,
+    const BakeHeader& header)
+{
+    std::memcpy(writer.bytes.data(), &header, sizeof(header));
+
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    auto path = bake_path(dir, resref, header.source_key);
+    auto temp = path;
+    temp += ".tmp";
+    {
+        std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(writer.bytes.data()), std::streamsize(writer.bytes.size()));
+        if (!out) {
+            LOG_F(ERROR, "Failed to write baked model: {}", temp.string());
+            return false;
+        }
+    }
+    std::filesystem::rename(temp, path, ec);
+    if (ec) {
+        LOG_F(ERROR, "Failed to write baked model: {}", path.string());
+        std::filesystem::remove(temp, ec);
+        return false;
+    }
+
+    // Bakes of older versions of the source will never match again
+    auto prefix = std::string(resref) + "-";
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        auto name = entry.path().filename().string();
+        if (name.size() == prefix.size() + 16 + std::strlen(bake_extension) && name.starts_with(prefix)
+            && name.ends_with(bake_extension) && entry.path() != path) {
+            std::filesystem::remove(entry.path(), ec);
+        }
+    }
+
+    LOG_F(INFO, "Baked {} ({} KiB)", resref, writer.bytes.size() >> 10);
+    return true;
+}
+
+} // namespace
+
+uint64_t fnv1a(std::span<const uint8_t> bytes, uint64_t hash)
+{
+    for (auto b : bytes) {
+        hash = (hash ^ b) * 1099511628211ull;
+    }
+    return hash;
+}
+
+uint64_t bake_options_hash()
+{
+    uint32_t options[] = {
+        Model::generate_lods,
+        Model::merge_static_meshes,
+        Node::layout.getStride(),
+        Node::layout.has(bgfx::Attrib::Normal),
+        Node::layout.has(bgfx::Attrib::Tangent),
+        texcoord_type(Node::layout),
+        Skin::layout.getStride(),
+        texcoord_type(Skin::layout),
+        // Skin source vertices are baked as they are
+        uint32_t(sizeof(nw::model::SkinVertex)),
+    };
+    return fnv1a({reinterpret_cast<const uint8_t*>(options), sizeof(options)});
+}
+
+uint64_t bake_source_key(uint64_t size, int64_t mtime)
+{
+    uint64_t fields[] = {size, uint64_t(mtime)};
+    return fnv1a({reinterpret_cast<const uint8_t*>(fields), sizeof(fields)});
+}
+
+uint64_t bake_chain_key(std::span<const std::string_view> names, std::span<const uint64_t> source_keys)
+{
+    uint64_t result = fnv1a({});
+    for (size_t i = 0; i < names.size() && i < source_keys.size(); ++i) {
+        uint64_t size = names[i].size();
+        result = fnv1a({reinterpret_cast<const uint8_t*>(&size), sizeof(size)}, result);
+        result = fnv1a({reinterpret_cast<const uint8_t*>(names[i].data()), names[i].size()}, result);
+        result = fnv1a({reinterpret_cast<const uint8_t*>(&source_keys[i]), sizeof(uint64_t)}, result);
+    }
+    return result;
+}
+
+bool BakedModel::open(const std::filesystem::path& path, uint64_t source_key)
+{
+    file_ = MappedFile::open(path);
+    if (!file_ || file_->size_ < sizeof(BakeHeader)) { return false; }
+
+    header_ = reinterpret_cast<const BakeHeader*>(file_->data_);
+    BakeHeader expected;
+    if (header_->magic != expected.magic || header_->version != bake_version || header_->source_key != source_key
+        || header_->options_hash != bake_options_hash()) {
+        return false;
+    }
+
+    // Everything read later is checked once here
+    const auto& h = *header_;
+    if (!in_file(*file_, h.supermodels_offset, h.num_supermodels, sizeof(BakedString))
+        || !in_file(*file_, h.nodes_offset, h.num_nodes, sizeof(BakedNode))
+        || !in_file(*file_, h.static_vertices_offset, h.static_vertices_size, 1)
+        || !in_file(*file_, h.static_indices_offset, h.num_static_indices, sizeof(uint16_t))
+        || !in_file(*file_, h.animations_offset, h.num_animations, sizeof(BakedAnimation))
+        || !in_file(*file_, h.animation_nodes_offset, h.num_animation_nodes, sizeof(BakedAnimationNode))
+        || !in_file(*file_, h.keys_offset, h.num_keys, sizeof(float))) {
+        return false;
+    }
+    for (const auto& name : array<BakedString>(h.supermodels_offset, h.num_supermodels)) {
+        if (!in_file(*file_, name)) { return false; }
+    }
+
+    nodes_ = array<BakedNode>(h.nodes_offset, h.num_nodes);
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        const auto& n = nodes_[i];
+        if (n.parent >= int64_t(i) || n.parent < -1 || !in_file(*file_, n.name) || !in_file(*file_, n.bitmap)
+            || !in_file(*file_, n.vertices_offset, n.vertices_size, 1)
+            || !in_file(*file_, n.indices_offset, n.num_indices, sizeof(uint16_t))
+            || !in_file(*file_, n.lods_offset, n.num_lods, sizeof(Lod))
+            || !in_file(*file_, n.positions_offset, n.num_positions, sizeof(glm::vec3))
+            || !in_file(*file_, n.skin_vertices_offset, n.num_skin_vertices, sizeof(nw::model::SkinVertex))
+            || !in_file(*file_, n.bones_offset, n.num_bones, sizeof(uint32_t))) {
+            return false;
+        }
+        for (auto bone : array<uint32_t>(n.bones_offset, n.num_bones)) {
+            if (bone >= h.num_nodes) { return false; }
+        }
+
+        // Draw ranges must stay within their buffers, ranges draw from the static ones
+        uint64_t num_indices = n.flags & baked_range ? h.num_static_indices : n.num_indices;
+        for (const auto& lod : array<Lod>(n.lods_offset, n.num_lods)) {
+            if (uint64_t(lod.first_index) + lod.num_indices > num_indices) { return false; }
+        }
+        if (n.flags & baked_range
+            && (uint64_t(n.first_index) + n.num_range_indices > h.num_static_indices
+                || (uint64_t(n.first_vertex) + n.num_vertices) * Node::layout.getStride() > h.static_vertices_size)) {
+            return false;
+        }
+    }
+
+    auto in_keys = [&h](const BakedTrack& t) {
+        return uint64_t(t.time_offset) + t.time_count <= h.num_keys && uint64_t(t.data_offset) + t.data_count <= h.num_keys;
+    };
+    for (const auto& a : array<BakedAnimation>(h.animations_offset, h.num_animations)) {
+        if (!in_file(*file_, a.name) || a.first_node > h.num_animation_nodes
+            || a.num_nodes > h.num_animation_nodes - a.first_node) {
+            return false;
+        }
+    }
+    for (const auto& n : array<BakedAnimationNode>(h.animation_nodes_offset, h.num_animation_nodes)) {
+        if (!in_file(*file_, n.name) || !in_keys(n.position) || !in_keys(n.orientation)) { return false; }
+    }
+    return true;
+}
+
+std::vector<std::string_view> BakedModel::supermodels() const
+{
+    std::vector<std::string_view> result;
+    for (const auto& name : array<BakedString>(header_->supermodels_offset, header_->num_supermodels)) {
+        result.push_back(string(name));
+    }
+    return result;
+}
+
+std::unique_ptr<AnimationSet> BakedModel::animations() const
+{
+    const auto& h = *header_;
+    auto result = std::make_unique<AnimationSet>();
+    auto keys = array<float>(h.keys_offset, h.num_keys);
+    result->keys.assign(keys.begin(), keys.end());
+
+    std::span<const float> all = result->keys;
+    auto track = [all](const BakedTrack& t) {
+        AnimationTrack result;
+        result.time = all.subspan(t.time_offset, t.time_count);
+        result.data = all.subspan(t.data_offset, t.data_count);
+        return result;
+    };
+
+    auto nodes = array<BakedAnimationNode>(h.animation_nodes_offset, h.num_animation_nodes);
+    for (const auto& a : array<BakedAnimation>(h.animations_offset, h.num_animations)) {
+        Animation anim;
+        anim.name = string(a.name);
+        anim.length = a.length;
+        for (const auto& n : nodes.subspan(a.first_node, a.num_nodes)) {
+            anim.nodes.push_back({std::string(string(n.name)), track(n.position), track(n.orientation)});
+        }
+        result->animations.push_back(std::move(anim));
+    }
+    return result;
+}
+
+std::filesystem::path bake_path(const std::filesystem::path& dir, std::string_view resref, uint64_t source_key)
+{
+    char hash[17];
+    std::snprintf(hash, sizeof(hash), "%016llx", static_cast<unsigned long long>(source_key));
+    return dir / (std::string(resref) + "-" + hash + bake_extension);
+}
+
+bool write_bake(const std::filesystem::path& dir, std::string_view resref, const Model& model, const BakeSource& source)
+{
+    BakeWriter writer;
+    auto header = begin_bake(writer, source);
+
+    std::vector<BakedNode> nodes;
+    for (const auto& node : model.nodes_) {
+        BakedNode baked;
+        baked.parent = node->parent_ ? int32_t(node->parent_->index_) : -1;
+        baked.name = writer.append_string(node->name_);
+        if (node->has_transform_) { baked.flags |= baked_transform; }
+        if (node->no_render_) { baked.flags |= baked_no_render; }
+        baked.position = node->position_;
+        baked.rotation = node->rotation_;
+
+        if (auto skin = dynamic_cast<const Skin*>(node.get())) {
+            baked.flags |= baked_skin;
+            auto vertices = skin->staged_vertices();
+            auto indices = skin->staged_indices();
+            baked.vertices_offset = writer.append(vertices);
+            baked.vertices_size = vertices.size();
+            baked.indices_offset = writer.append(indices);
+            baked.num_indices = indices.size();
+            baked.lods_offset = writer.append(std::span<const Lod>(skin->lods_));
+            baked.num_lods = skin->lods_.size();
+            baked.skin_vertices_offset = writer.append(std::span<const nw::model::SkinVertex>(skin->source_vertices_));
+            baked.num_skin_vertices = skin->source_vertices_.size();
+            baked.bones_offset = writer.append(std::span<const uint32_t>(skin->bone_nodes_));
+            baked.num_bones = skin->bone_nodes_.size();
+            baked.bitmap = writer.append_string(skin->bitmap_);
+            baked.dequant = skin->dequant_;
+        } else if (auto mesh = dynamic_cast<const Mesh*>(node.get())) {
+            baked.flags |= baked_mesh;
+            if (mesh->merged_) { baked.flags |= baked_merged; }
+            if (mesh->range_) {
+                baked.flags |= baked_range;
+                baked.first_vertex = mesh->first_vertex_;
+                baked.num_vertices = mesh->num_vertices_;
+                baked.first_index = mesh->first_index_;
+                baked.num_range_indices = mesh->num_indices_;
+            }
+            auto vertices = mesh->staged_vertices();
+            auto indices = mesh->staged_indices();
+            baked.vertices_offset = writer.append(vertices);
+            baked.vertices_size = vertices.size();
+            baked.indices_offset = writer.append(indices);
+            baked.num_indices = indices.size();
+            baked.lods_offset = writer.append(std::span<const Lod>(mesh->lods_));
+            baked.num_lods = mesh->lods_.size();
+            baked.positions_offset = writer.append(std::span<const glm::vec3>(mesh->positions_));
+            baked.num_positions = mesh->positions_.size();
+            baked.bitmap = writer.append_string(mesh->bitmap_);
+            baked.dequant = mesh->dequant_;
+            baked.aabb = mesh->aabb_;
+            baked.sphere = mesh->sphere_;
+        }
+        nodes.push_back(baked);
+    }
+
+    auto static_vertices = model.staged_static_vertices();
+    auto static_indices = model.staged_static_indices();
+    header.static_vertices_offset = writer.append(static_vertices);
+    header.static_vertices_size = static_vertices.size();
+    header.static_indices_offset = writer.append(static_indices);
+    header.num_static_indices = static_indices.size();
+    header.nodes_offset = writer.append(std::span<const BakedNode>(nodes));
+    header.num_nodes = nodes.size();
+    if (model.animations_) { append_animations(writer, header, *model.animations_); }
+    return finish_bake(dir, resref, writer, header);
+}
+
+bool write_bake(const std::filesystem::path& dir, std::string_view resref, const AnimationSet& animations,
+    const BakeSource& source)
+{
+    BakeWriter writer;
+    auto header = begin_bake(writer, source);
+    header.flags |= bake_animations_only;
+    append_animations(writer, header, animations);
+    return finish_bake(dir, resref, writer, header);
+}
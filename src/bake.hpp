@@ -0,0 +1,188 @@
+#pragma once
+
+#include "MappedFile.hpp"
+#include "animation.hpp"
+#include "culling.hpp"
+#include "lod.hpp"
+#include "packing.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Model;
+
+/// Version of baked model files, bumped whenever their layout or anything baked into them changes
+constexpr uint32_t bake_version = 3;
+
+/// 64 bit FNV-1a
+uint64_t fnv1a(std::span<const uint8_t> bytes, uint64_t hash = 14695981039346656037ull);
+
+/// Hashes load options that change what is baked: vertex layouts and their texture coordinate type,
+/// ``Model::generate_lods`` and ``Model::merge_static_meshes``
+uint64_t bake_options_hash();
+
+/// Gets the key a bake of a resource is valid for, from its size and modification time rather than its content
+uint64_t bake_source_key(uint64_t size, int64_t mtime);
+
+enum BakedNodeFlags : uint32_t {
+    baked_mesh = 1 << 0,
+    baked_skin = 1 << 1,
+    /// A static mesh drawn as part of a merged range
+    baked_merged = 1 << 2,
+    /// A merged range added by ``Model::merge_meshes``
+    baked_range = 1 << 3,
+    baked_no_render = 1 << 4,
+    baked_transform = 1 << 5,
+};
+
+enum BakeFlags : uint32_t {
+    /// Only animations were baked, for a model only loaded as a supermodel
+    bake_animations_only = 1 << 0,
+};
+
+/// A string in the file, not null terminated
+struct BakedString {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+};
+
+/// A node of ``Model::nodes_`` and everything ``Model::load_node`` derives from it, or ``Model::merge_meshes``
+/// from a merged range.  Offsets are from the start of the file.
+struct BakedNode {
+    uint32_t flags = 0;
+    /// Index of the parent in ``BakedModel::nodes_``, which always precedes its children, -1 for roots
+    int32_t parent = -1;
+    BakedString name;
+    glm::vec3 position{0.0f};
+    glm::quat rotation{};
+    uint64_t vertices_offset = 0;
+    uint64_t vertices_size = 0;
+    uint64_t indices_offset = 0;
+    uint64_t num_indices = 0;
+    uint64_t lods_offset = 0;
+    uint64_t num_lods = 0;
+    /// Node space positions of meshes, see ``Mesh::positions_``
+    uint64_t positions_offset = 0;
+    uint64_t num_positions = 0;
+    /// Source vertices and bone nodes of skins, see ``Skin::source_vertices_``
+    uint64_t skin_vertices_offset = 0;
+    uint64_t num_skin_vertices = 0;
+    uint64_t bones_offset = 0;
+    uint64_t num_bones = 0;
+    BakedString bitmap;
+    /// Draw range of a merged range in the model's static buffers
+    uint32_t first_vertex = 0;
+    uint32_t num_vertices = 0;
+    uint32_t first_index = 0;
+    uint32_t num_range_indices = 0;
+    Dequantize dequant;
+    Aabb aabb;
+    Sphere sphere;
+};
+
+/// Keys of a track, offsets and counts are in floats of the file's keys
+struct BakedTrack {
+    uint32_t time_offset = 0;
+    uint32_t time_count = 0;
+    uint32_t data_offset = 0;
+    uint32_t data_count = 0;
+};
+
+struct BakedAnimationNode {
+    BakedString name;
+    BakedTrack position;
+    BakedTrack orientation;
+};
+
+struct BakedAnimation {
+    BakedString name;
+    float length = 0.0f;
+    uint32_t num_nodes = 0;
+    /// Index of the first node in the file's animation nodes
+    uint64_t first_node = 0;
+};
+
+struct BakeHeader {
+    /// "MUDB"
+    uint32_t magic = 0x4244554d;
+    uint32_t version = bake_version;
+    uint64_t source_key = 0;
+    /// Hash of the names and source keys of the supermodel chain, see ``bake_chain_key``
+    uint64_t chain_key = 0;
+    uint64_t options_hash = 0;
+    uint32_t flags = 0;
+    uint32_t num_supermodels = 0;
+    /// Names of the supermodel chain, nearest first
+    uint64_t supermodels_offset = 0;
+    uint64_t nodes_offset = 0;
+    uint64_t num_nodes = 0;
+    /// Model space vertices and indices of merged ranges
+    uint64_t static_vertices_offset = 0;
+    uint64_t static_vertices_size = 0;
+    uint64_t static_indices_offset = 0;
+    uint64_t num_static_indices = 0;
+    uint64_t animations_offset = 0;
+    uint64_t num_animations = 0;
+    uint64_t animation_nodes_offset = 0;
+    uint64_t num_animation_nodes = 0;
+    uint64_t keys_offset = 0;
+    uint64_t num_keys = 0;
+};
+
+/// A mapped and validated baked model, all spans point into the mapping
+struct BakedModel {
+    /// Maps a baked file, fails if it's missing, malformed, or baked from another source or with other options.
+    /// The supermodel chain is checked by the caller, see ``bake_chain_key``.
+    bool open(const std::filesystem::path& path, uint64_t source_key);
+
+    /// Gets names of the supermodel chain, nearest first
+    std::vector<std::string_view> supermodels() const;
+
+    /// Copies the baked animations
+    std::unique_ptr<AnimationSet> animations() const;
+
+    template <typename T>
+    std::span<const T> array(uint64_t offset, uint64_t count) const
+    {
+        return {reinterpret_cast<const T*>(file_->data_ + offset), size_t(count)};
+    }
+
+    std::string_view string(const BakedString& str) const
+    {
+        return {reinterpret_cast<const char*>(file_->data_ + str.offset), size_t(str.size)};
+    }
+
+    std::shared_ptr<MappedFile> file_;
+    const BakeHeader* header_ = nullptr;
+    std::span<const BakedNode> nodes_;
+};
+
+/// What a bake was derived from
+struct BakeSource {
+    /// See ``bake_source_key``
+    uint64_t key = 0;
+    /// See ``bake_chain_key``
+    uint64_t chain_key = 0;
+    /// Names of the supermodel chain, nearest first
+    std::vector<std::string> supermodels;
+};
+
+/// Hashes names and source keys of a supermodel chain, so a bake is only used while every supermodel is unchanged
+uint64_t bake_chain_key(std::span<const std::string_view> names, std::span<const uint64_t> source_keys);
+
+/// Gets the path of a model's baked file, named by resref and source key
+std::filesystem::path bake_path(const std::filesystem::path& dir, std::string_view resref, uint64_t source_key);
+
+/// Writes the hierarchy, animations and what ``model`` staged at load, so must be called before
+/// ``Model::upload``.  Writes through a temporary file so readers never map a partial one, and removes files
+/// baked from older versions of the source.
+bool write_bake(const std::filesystem::path& dir, std::string_view resref, const Model& model, const BakeSource& source);
+
+/// Writes only the animations of a model loaded as a supermodel
+bool write_bake(const std::filesystem::path& dir, std::string_view resref, const AnimationSet& animations,
+    const BakeSource& source);
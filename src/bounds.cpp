@@ -0,0 +1,52 @@
+#include "bounds.hpp"
+
+#include "ModelCache.hpp"
+#include "TextureCache.hpp"
+#include "WorkerPool.hpp"
+
+#include <bgfx/bgfx.h>
+#include <bgfx/platform.h>
+
+#include <iostream>
+
+extern ModelCache s_models;
+extern TextureCache s_textures;
+WorkerPool& s_workers();
+
+bool bounds(std::string_view resref, std::string_view animation, int32_t time)
+{
+    bgfx::renderFrame(); // single threaded mode
+    bgfx::Init bgfx_init;
+    bgfx_init.type = bgfx::RendererType::Noop;
+    if (!bgfx::init(bgfx_init)) {
+        LOG_F(ERROR, "Failed to initialize bgfx");
+        return false;
+    }
+    init_vertex_layouts();
+    s_textures.load_placeholder();
+
+    bool result = false;
+    Model* model = s_models.load(resref);
+    if (!model) {
+        LOG_F(ERROR, "Unable to load model: {}", resref);
+    } else if (animation.size() && !model->load_animation(animation)) {
+        LOG_F(ERROR, "Failed to load animation: {}", animation);
+    } else {
+        model->update(time);
+
+        glm::vec3 min, max;
+        if (model->posed_bounds(min, max, &s_workers())) {
+            std::cout << resref << ": min (" << min.x << ", " << min.y << ", " << min.z << ")"
+                      << " max (" << max.x << ", " << max.y << ", " << max.z << ")\n";
+            result = true;
+        } else {
+            LOG_F(ERROR, "Model has no geometry: {}", resref);
+        }
+    }
+
+    // The caches are globals and would otherwise destroy their bgfx resources after bgfx is gone
+    s_models.clear();
+    s_textures.clear();
+    bgfx::shutdown();
+    return result;
+}
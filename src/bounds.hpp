@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+/// Prints model space bounds of a model, optionally posed at ``time`` milliseconds into an animation.
+/// Runs headless on the Noop renderer, skins are posed on the CPU.
+bool bounds(std::string_view resref, std::string_view animation = {}, int32_t time = 0);
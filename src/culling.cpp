@@ -0,0 +1,94 @@
+#include "culling.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MUDL_CULLING_SSE 1
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+Frustum Frustum::from_matrix(const glm::mat4& view_proj, bool zero_to_one)
+{
+    auto row = [&view_proj](int i) {
+        return glm::vec4{view_proj[0][i], view_proj[1][i], view_proj[2][i], view_proj[3][i]};
+    };
+    auto r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+
+    Frustum result;
+    result.planes[0] = r3 + r0; // Left
+    result.planes[1] = r3 - r0; // Right
+    result.planes[2] = r3 + r1; // Bottom
+    result.planes[3] = r3 - r1; // Top
+    result.planes[4] = zero_to_one ? r2 : r3 + r2; // Near
+    result.planes[5] = r3 - r2; // Far
+
+    for (auto& p : result.planes) {
+        float len = std::sqrt(p.x * p.x + p.y * p.y + p.z * p.z);
+        if (len > 0.0f) { p = p * (1.0f / len); }
+    }
+    return result;
+}
+
+Sphere to_sphere(const Aabb& aabb)
+{
+    return {(aabb.min + aabb.max) * 0.5f, glm::length(aabb.max - aabb.min) * 0.5f};
+}
+
+Sphere transform_sphere(const Sphere& sphere, const glm::mat4& mtx)
+{
+    auto c = mtx * glm::vec4{sphere.center, 1.0f};
+    float sx = glm::dot(mtx[0], mtx[0]);
+    float sy = glm::dot(mtx[1], mtx[1]);
+    float sz = glm::dot(mtx[2], mtx[2]);
+    return {glm::vec3{c.x, c.y, c.z}, sphere.radius * std::sqrt(std::max({sx, sy, sz}))};
+}
+
+inline bool sphere_visible(const Frustum& frustum, const Sphere& s)
+{
+    for (const auto& p : frustum.planes) {
+        if (p.x * s.center.x + p.y * s.center.y + p.z * s.center.z + p.w <= -s.radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t cull_spheres(const Frustum& frustum, std::span<const Sphere> spheres, std::span<uint8_t> visible)
+{
+    size_t count = 0;
+    size_t i = 0;
+
+#if defined(MUDL_CULLING_SSE)
+    for (; i + 4 <= spheres.size(); i += 4) {
+        // Load four spheres as rows and transpose to x, y, z, radius lanes
+        __m128 x = _mm_loadu_ps(&spheres[i].center.x);
+        __m128 y = _mm_loadu_ps(&spheres[i + 1].center.x);
+        __m128 z = _mm_loadu_ps(&spheres[i + 2].center.x);
+        __m128 r = _mm_loadu_ps(&spheres[i + 3].center.x);
+        _MM_TRANSPOSE4_PS(x, y, z, r);
+
+        __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), r);
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const auto& p : frustum.planes) {
+            __m128 d = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(p.x)), _mm_mul_ps(y, _mm_set1_ps(p.y))),
+                _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(p.z)), _mm_set1_ps(p.w)));
+            inside = _mm_and_ps(inside, _mm_cmpgt_ps(d, neg_r));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (size_t k = 0; k < 4; ++k) {
+            visible[i + k] = uint8_t((mask >> k) & 1);
+            count += visible[i + k];
+        }
+    }
+#endif
+
+    for (; i < spheres.size(); ++i) {
+        visible[i] = sphere_visible(frustum, spheres[i]) ? 1 : 0;
+        count += visible[i];
+    }
+
+    return count;
+}
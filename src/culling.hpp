@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+struct Aabb {
+    glm::vec3 min{0.0f};
+    glm::vec3 max{0.0f};
+};
+
+struct Sphere {
+    glm::vec3 center{0.0f};
+    float radius = 0.0f;
+};
+static_assert(sizeof(Sphere) == 4 * sizeof(float), "cull_spheres loads spheres as four floats");
+
+/// View frustum as six inward facing planes, xyz is the normal and w the distance
+struct Frustum {
+    std::array<glm::vec4, 6> planes;
+
+    /// Extracts planes from a combined view projection matrix, ``zero_to_one`` selects D3D style clip space depth
+    static Frustum from_matrix(const glm::mat4& view_proj, bool zero_to_one = false);
+};
+
+/// Visible and culled counts, one per tested mesh instance
+struct CullStats {
+    uint32_t visible = 0;
+    uint32_t culled = 0;
+};
+
+/// Computes bounding sphere of an axis aligned box
+Sphere to_sphere(const Aabb& aabb);
+
+/// Transforms a sphere, scaling its radius by the largest axis scale of ``mtx``
+Sphere transform_sphere(const Sphere& sphere, const glm::mat4& mtx);
+
+/// Tests spheres against the frustum four at a time, writing 1 to ``visible`` for spheres at least partially
+/// inside and 0 otherwise.  Returns the number of visible spheres.
+size_t cull_spheres(const Frustum& frustum, std::span<const Sphere> spheres, std::span<uint8_t> visible);
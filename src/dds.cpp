@@ -0,0 +1,106 @@
+#include "dds.hpp"
+
+#include "mipmap.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+constexpr uint32_t make_fourcc(char a, char b, char c, char d)
+{
+    return uint32_t(uint8_t(a)) | uint32_t(uint8_t(b)) << 8 | uint32_t(uint8_t(c)) << 16 | uint32_t(uint8_t(d)) << 24;
+}
+
+constexpr uint32_t dds_magic = make_fourcc('D', 'D', 'S', ' ');
+constexpr uint32_t dds_fourcc_dxt1 = make_fourcc('D', 'X', 'T', '1');
+constexpr uint32_t dds_fourcc_dxt5 = make_fourcc('D', 'X', 'T', '5');
+constexpr uint32_t ddpf_fourcc = 0x4;
+constexpr size_t dds_header_size = 128;
+constexpr size_t bio_header_size = 20;
+
+inline uint32_t read_u32(std::span<const uint8_t> bytes, size_t offset)
+{
+    uint32_t result;
+    std::memcpy(&result, bytes.data() + offset, sizeof(result));
+    return result;
+}
+
+// Counts levels that fit in the data, keeping all only if the chain is complete
+bool finish(std::span<const uint8_t> bytes, uint32_t stored, DdsImage& result)
+{
+    if (result.width == 0 || result.height == 0 || result.offset > bytes.size()) { return false; }
+
+    size_t available = bytes.size() - result.offset;
+    uint32_t w = result.width, h = result.height;
+    uint32_t levels = 0;
+    size_t size = 0;
+    while (levels < std::max(stored, 1u)) {
+        size_t level = dds_level_size(result.format, w, h);
+        if (size + level > available) { break; }
+        size += level;
+        ++levels;
+        if (w == 1 && h == 1) { break; }
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
+    }
+    if (levels == 0) { return false; }
+
+    if (levels == mip_count(result.width, result.height)) {
+        result.mips = levels;
+        result.size = size;
+    } else {
+        result.mips = 1;
+        result.size = dds_level_size(result.format, result.width, result.height);
+    }
+    return true;
+}
+
+} // namespace
+
+size_t dds_level_size(bgfx::TextureFormat::Enum format, uint32_t width, uint32_t height)
+{
+    size_t block = format == bgfx::TextureFormat::BC1 ? 8 : 16;
+    return size_t(std::max((width + 3) / 4, 1u)) * std::max((height + 3) / 4, 1u) * block;
+}
+
+bool parse_dds(std::span<const uint8_t> bytes, DdsImage& result)
+{
+    result = DdsImage{};
+
+    if (bytes.size() >= dds_header_size && read_u32(bytes, 0) == dds_magic) {
+        if (!(read_u32(bytes, 80) & ddpf_fourcc)) { return false; }
+        auto fourcc = read_u32(bytes, 84);
+        if (fourcc == dds_fourcc_dxt1) {
+            result.format = bgfx::TextureFormat::BC1;
+        } else if (fourcc == dds_fourcc_dxt5) {
+            result.format = bgfx::TextureFormat::BC3;
+        } else {
+            return false;
+        }
+        result.height = read_u32(bytes, 12);
+        result.width = read_u32(bytes, 16);
+        result.offset = dds_header_size;
+        return finish(bytes, read_u32(bytes, 28), result);
+    }
+
+    // Bioware DDS: width, height, color channels (3 for DXT1, 4 for DXT5), unused, alpha mean.  Stores all
+    // levels that fit in the file.
+    if (bytes.size() >= bio_header_size) {
+        auto channels = read_u32(bytes, 8);
+        if (channels == 3) {
+            result.format = bgfx::TextureFormat::BC1;
+        } else if (channels == 4) {
+            result.format = bgfx::TextureFormat::BC3;
+        } else {
+            return false;
+        }
+        result.width = read_u32(bytes, 0);
+        result.height = read_u32(bytes, 4);
+        if (result.width > 8192 || result.height > 8192) { return false; }
+        result.offset = bio_header_size;
+        return finish(bytes, mip_count(result.width, result.height), result);
+    }
+
+    return false;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <bgfx/bgfx.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/// Block compressed image data inside a DDS file
+struct DdsImage {
+    bgfx::TextureFormat::Enum format = bgfx::TextureFormat::Unknown;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    /// Number of levels in ``[offset, offset + size)``, either 1 or the full chain down to 1x1
+    uint32_t mips = 0;
+    size_t offset = 0;
+    size_t size = 0;
+};
+
+/// Gets the size in bytes of one level of a block compressed image
+size_t dds_level_size(bgfx::TextureFormat::Enum format, uint32_t width, uint32_t height);
+
+/// Finds DXT1 or DXT5 data in a standard or Bioware DDS file.  A partial mip chain is cut down to the top level,
+/// since bgfx expects all or none.  Returns false for anything else, which has to be decoded.
+bool parse_dds(std::span<const uint8_t> bytes, DdsImage& result);
@@ -0,0 +1,305 @@
+#include "lod.hpp"
+
+#include "meshopt.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+// Symmetric 4x4 error quadric of a set of planes, ``error(p) = p'Ap + 2b'p + c``, the sum of squared distances
+// of ``p`` to the planes
+struct Quadric {
+    float a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    float b0 = 0, b1 = 0, b2 = 0;
+    float c = 0;
+
+    static Quadric from_plane(const glm::vec3& n, float d)
+    {
+        Quadric q;
+        q.a00 = n.x * n.x;
+        q.a01 = n.x * n.y;
+        q.a02 = n.x * n.z;
+        q.a11 = n.y * n.y;
+        q.a12 = n.y * n.z;
+        q.a22 = n.z * n.z;
+        q.b0 = n.x * d;
+        q.b1 = n.y * d;
+        q.b2 = n.z * d;
+        q.c = d * d;
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric& o)
+    {
+        a00 += o.a00, a01 += o.a01, a02 += o.a02, a11 += o.a11, a12 += o.a12, a22 += o.a22;
+        b0 += o.b0, b1 += o.b1, b2 += o.b2;
+        c += o.c;
+        return *this;
+    }
+
+    float error(const glm::vec3& p) const
+    {
+        float rx = a00 * p.x + a01 * p.y + a02 * p.z + b0;
+        float ry = a01 * p.x + a11 * p.y + a12 * p.z + b1;
+        float rz = a02 * p.x + a12 * p.y + a22 * p.z + b2;
+        float result = rx * p.x + ry * p.y + rz * p.z + b0 * p.x + b1 * p.y + b2 * p.z + c;
+        return std::max(result, 0.0f);
+    }
+};
+
+struct Collapse {
+    uint16_t from;
+    uint16_t to;
+    float cost;
+};
+
+glm::vec3 triangle_normal(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2)
+{
+    return glm::cross(p1 - p0, p2 - p0);
+}
+
+// Locks vertices that share a position with another vertex, i.e. lie on a UV seam, and vertices of edges
+// that don't have exactly two triangles
+std::vector<uint8_t> find_locked(std::span<const uint16_t> indices, std::span<const glm::vec3> positions)
+{
+    std::vector<uint8_t> locked(positions.size(), 0);
+
+    std::vector<uint32_t> order(positions.size());
+    std::iota(order.begin(), order.end(), 0);
+    auto less = [&](uint32_t a, uint32_t b) {
+        const auto &pa = positions[a], &pb = positions[b];
+        if (pa.x != pb.x) { return pa.x < pb.x; }
+        if (pa.y != pb.y) { return pa.y < pb.y; }
+        return pa.z < pb.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+    for (size_t i = 1; i < order.size(); ++i) {
+        if (positions[order[i]] == positions[order[i - 1]]) {
+            locked[order[i]] = locked[order[i - 1]] = 1;
+        }
+    }
+
+    std::vector<uint32_t> edges;
+    edges.reserve(indices.size());
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        for (int k = 0; k < 3; ++k) {
+            uint32_t a = indices[i + k], b = indices[i + (k + 1) % 3];
+            edges.push_back(std::min(a, b) << 16 | std::max(a, b));
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size();) {
+        size_t j = i;
+        while (j < edges.size() && edges[j] == edges[i]) {
+            ++j;
+        }
+        if (j - i != 2) {
+            locked[edges[i] >> 16] = 1;
+            locked[edges[i] & 0xffff] = 1;
+        }
+        i = j;
+    }
+
+    return locked;
+}
+
+} // namespace
+
+std::vector<uint16_t> simplify(std::span<const uint16_t> indices, std::span<const glm::vec3> positions,
+    std::span<const uint32_t> groups, size_t target_index_count, float max_error, float* result_error)
+{
+    std::vector<uint16_t> result(indices.begin(), indices.end());
+    if (result_error) { *result_error = 0.0f; }
+    for (auto idx : indices) {
+        if (idx >= positions.size()) { return result; }
+    }
+
+    const size_t vertex_count = positions.size();
+    auto locked = find_locked(indices, positions);
+
+    // Planes are unweighted, so a quadric's error is a squared distance and bounds the squared distance to
+    // each of its planes, whatever the size of the triangles
+    std::vector<Quadric> quadrics(vertex_count);
+    for (size_t i = 0; i + 2 < result.size(); i += 3) {
+        const auto& p0 = positions[result[i]];
+        const auto& p1 = positions[result[i + 1]];
+        const auto& p2 = positions[result[i + 2]];
+        auto n = triangle_normal(p0, p1, p2);
+        float length = glm::length(n);
+        if (length == 0.0f) { continue; }
+        n = n / length;
+        auto q = Quadric::from_plane(n, -glm::dot(n, p0));
+        for (int k = 0; k < 3; ++k) {
+            quadrics[result[i + k]] += q;
+        }
+    }
+
+    auto allowed = [&](uint16_t from, uint16_t to) {
+        return !locked[from] && (groups.empty() || groups[from] == groups[to]);
+    };
+
+    const float max_cost = max_error * max_error;
+    float error = 0.0f;
+
+    std::vector<uint32_t> edges;
+    std::vector<Collapse> collapses;
+    std::vector<uint16_t> target(vertex_count);
+    std::vector<uint8_t> touched(vertex_count);
+    std::vector<uint32_t> adjacency_offsets(vertex_count + 1);
+    std::vector<uint32_t> adjacency;
+
+    while (result.size() > target_index_count) {
+        // Unique edges of the current mesh
+        edges.clear();
+        for (size_t i = 0; i < result.size(); i += 3) {
+            for (int k = 0; k < 3; ++k) {
+                uint32_t a = result[i + k], b = result[i + (k + 1) % 3];
+                edges.push_back(std::min(a, b) << 16 | std::max(a, b));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        // Cheapest allowed direction of each edge
+        collapses.clear();
+        for (auto e : edges) {
+            auto a = uint16_t(e >> 16), b = uint16_t(e & 0xffff);
+            float ab = allowed(a, b) ? quadrics[a].error(positions[b]) : std::numeric_limits<float>::max();
+            float ba = allowed(b, a) ? quadrics[b].error(positions[a]) : std::numeric_limits<float>::max();
+            if (ab <= ba && ab <= max_cost) {
+                collapses.push_back({a, b, ab});
+            } else if (ba < ab && ba <= max_cost) {
+                collapses.push_back({b, a, ba});
+            }
+        }
+        if (collapses.empty()) { break; }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) {
+            return x.cost < y.cost;
+        });
+
+        // Vertex to triangle adjacency for flip checks
+        std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+        for (auto idx : result) {
+            ++adjacency_offsets[idx + 1];
+        }
+        std::partial_sum(adjacency_offsets.begin(), adjacency_offsets.end(), adjacency_offsets.begin());
+        adjacency.resize(result.size());
+        std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+        for (size_t i = 0; i < result.size(); ++i) {
+            adjacency[fill[result[i]]++] = uint32_t(i / 3);
+        }
+
+        std::iota(target.begin(), target.end(), uint16_t(0));
+        std::fill(touched.begin(), touched.end(), 0);
+
+        // Each triangle around a collapsed vertex is either removed or has the vertex moved, a collapse of an
+        // interior edge removes two
+        size_t triangles = result.size() / 3;
+        const size_t target_triangles = target_index_count / 3;
+        size_t applied = 0;
+        for (const auto& c : collapses) {
+            if (triangles <= target_triangles) { break; }
+            if (touched[c.from] || touched[c.to]) { continue; }
+
+            // Reject collapses that flip or degenerate a remaining triangle
+            bool flips = false;
+            size_t removed = 0;
+            for (uint32_t j = adjacency_offsets[c.from]; j < adjacency_offsets[c.from + 1]; ++j) {
+                const uint16_t* tri = &result[adjacency[j] * 3];
+                if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) {
+                    ++removed;
+                    continue;
+                }
+                glm::vec3 p[3], q[3];
+                for (int k = 0; k < 3; ++k) {
+                    p[k] = positions[tri[k]];
+                    q[k] = tri[k] == c.from ? positions[c.to] : p[k];
+                }
+                auto before = triangle_normal(p[0], p[1], p[2]);
+                auto after = triangle_normal(q[0], q[1], q[2]);
+                if (glm::dot(before, after) <= 0.0f) {
+                    flips = true;
+                    break;
+                }
+            }
+            if (flips) { continue; }
+
+            target[c.from] = c.to;
+            quadrics[c.to] += quadrics[c.from];
+            error = std::max(error, c.cost);
+            triangles -= removed;
+            ++applied;
+
+            // Neighbors keep their positions for the rest of the pass, so flip checks stay valid
+            for (uint32_t j = adjacency_offsets[c.from]; j < adjacency_offsets[c.from + 1]; ++j) {
+                const uint16_t* tri = &result[adjacency[j] * 3];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+            }
+        }
+        if (applied == 0) { break; }
+
+        size_t out = 0;
+        for (size_t i = 0; i < result.size(); i += 3) {
+            uint16_t a = target[result[i]], b = target[result[i + 1]], c = target[result[i + 2]];
+            if (a == b || b == c || a == c) { continue; }
+            result[out++] = a;
+            result[out++] = b;
+            result[out++] = c;
+        }
+        result.resize(out);
+    }
+
+    if (result_error) { *result_error = std::sqrt(error); }
+    return result;
+}
+
+std::vector<Lod> build_lods(std::vector<uint16_t>& indices, uint32_t first, uint32_t count,
+    std::span<const glm::vec3> positions, std::span<const uint32_t> groups, size_t max_levels)
+{
+    std::vector<Lod> result;
+    if (count < 3 * 16 || positions.empty()) { return result; }
+
+    glm::vec3 min = positions[0], max = positions[0];
+    for (const auto& p : positions) {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+    // Each level may deviate from the previous by up to a tenth of the mesh size
+    const float max_error = glm::length(max - min) * 0.1f;
+
+    std::vector<uint16_t> source(indices.begin() + first, indices.begin() + first + count);
+    for (size_t level = 0; level < max_levels; ++level) {
+        float error = 0.0f;
+        auto simplified = simplify(source, positions, groups, source.size() / 2 / 3 * 3, max_error, &error);
+        if (simplified.size() * 4 > source.size() * 3) { break; }
+
+        optimize_vertex_cache(simplified, positions.size());
+
+        Lod lod;
+        lod.first_index = uint32_t(indices.size());
+        lod.num_indices = uint32_t(simplified.size());
+        // Each level's error is measured against the previous one, so the sum bounds the distance to full detail
+        lod.error = result.empty() ? error : result.back().error + error;
+        indices.insert(indices.end(), simplified.begin(), simplified.end());
+        result.push_back(lod);
+        source = std::move(simplified);
+    }
+
+    return result;
+}
+
+uint32_t LodSelector::select(std::span<const Lod> lods, const glm::vec3& center, float radius, float scale) const
+{
+    if (projection_scale <= 0.0f) { return 0; }
+
+    float distance = std::max(glm::length(center - eye) - radius, 1e-3f);
+    uint32_t result = 0;
+    for (size_t i = 0; i < lods.size(); ++i) {
+        if (lods[i].error * scale * projection_scale / distance > max_pixel_error) { break; }
+        result = uint32_t(i + 1);
+    }
+    return result;
+}
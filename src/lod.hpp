@@ -0,0 +1,42 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/// A simplified level of a mesh, an index range sharing the vertices of full detail
+struct Lod {
+    uint32_t first_index = 0;
+    uint32_t num_indices = 0;
+    /// Largest distance in node space between the simplified and the full detail surface
+    float error = 0.0f;
+};
+
+/// Simplifies triangles by collapsing edges onto existing vertices in order of quadric error, so the result
+/// indexes the same vertices.  Vertices on UV seams and open borders are never removed, and a vertex is only
+/// collapsed onto one in the same group, e.g. with the same dominant bone.  ``groups`` may be empty.
+/// Stops at ``target_index_count`` or when any collapse would exceed ``max_error``.
+std::vector<uint16_t> simplify(std::span<const uint16_t> indices, std::span<const glm::vec3> positions,
+    std::span<const uint32_t> groups, size_t target_index_count, float max_error, float* result_error = nullptr);
+
+/// Simplifies ``indices[first, first + count)`` into up to ``max_levels`` levels of about half the triangles of
+/// the previous, appending each to ``indices``.  Levels that don't remove at least a quarter of the triangles
+/// of the previous one are dropped.
+std::vector<Lod> build_lods(std::vector<uint16_t>& indices, uint32_t first, uint32_t count,
+    std::span<const glm::vec3> positions, std::span<const uint32_t> groups, size_t max_levels = 3);
+
+/// Picks levels of detail from projected error
+struct LodSelector {
+    glm::vec3 eye{0.0f};
+    /// Pixels covered by one unit at a distance of one, i.e. ``viewport height / (2 tan(fovy / 2))``
+    float projection_scale = 0.0f;
+    /// Largest acceptable projected error in pixels
+    float max_pixel_error = 1.0f;
+
+    /// Gets the coarsest level whose error projects to at most ``max_pixel_error``, 0 is full detail.
+    /// ``scale`` maps node space error to world space.
+    uint32_t select(std::span<const Lod> lods, const glm::vec3& center, float radius, float scale) const;
+};
@@ -1,6 +1,8 @@
 #include "ModelCache.hpp"
 #include "TextureCache.hpp"
+#include "WorkerPool.hpp"
 #include "bgfx-imgui/imgui_impl_bgfx.h"
+#include "bounds.hpp"
 #include "extract.hpp"
 #include "model.hpp"
 #include "sdl-imgui/imgui_impl_sdl.h"
@@ -25,26 +27,159 @@
 #include <SDL2/SDL_syswm.h>
 #include <absl/container/btree_set.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
 #include <iostream>
+#include <mutex>
+#include <optional>
 #include <regex>
 #include <string>
+#include <thread>
 #include <vector>
 
 using namespace std::literals;
 
-ModelCache s_models;
+// Models release textures when destroyed, so the texture cache has to outlive the model cache
 TextureCache s_textures;
+ModelCache s_models;
+
+/// Started on first use, so commands that don't need workers don't start threads.  Constructed after the
+/// caches, so it's destroyed first and no job outlives the payloads it fills.
+WorkerPool& s_workers()
+{
+    static WorkerPool pool;
+    return pool;
+}
+
+auto usage = R"eof(usage: mudl [--render-thread] [--encoders <count>] [--texture-budget <MiB>]
+            [--model-budget <MiB>] [--bake-dir <path>] | [<command>] [<args>]
 
-auto usage = R"eof(usage: mudl [<command>] [<args>]
+Options
+-------
+    --render-thread     Builds frames on a separate thread while the main thread renders
+    --encoders          Maximum number of bgfx encoders, draws are recorded in parallel through all but one
+    --texture-budget    Texture memory kept before unused textures are evicted, 512 by default
+    --model-budget      Model memory kept before unused models are evicted, 1024 by default
+    --bake-dir          Directory of baked GPU ready models, "cache" by default, an empty path disables baking
 
 Commands
 --------
     extract     Extracts a model and all its corresponding textures
+    bounds      Prints bounds of a model, optionally posed by an animation
 )eof";
 
+/// Window and mouse state, sampled on the main thread since SDL's window and mouse functions aren't thread safe
+struct InputState {
+    /// Zero while minimized
+    int window_width = 0;
+    int window_height = 0;
+    int drawable_width = 0;
+    int drawable_height = 0;
+    int mouse_x = 0;
+    int mouse_y = 0;
+    uint32_t mouse_buttons = 0;
+};
+
+InputState sample_input(SDL_Window* window)
+{
+    InputState result;
+    if (!(SDL_GetWindowFlags(window) & SDL_WINDOW_MINIMIZED)) {
+        SDL_GetWindowSize(window, &result.window_width, &result.window_height);
+    }
+    SDL_GL_GetDrawableSize(window, &result.drawable_width, &result.drawable_height);
+    result.mouse_buttons = SDL_GetMouseState(&result.mouse_x, &result.mouse_y);
+    return result;
+}
+
+/// Replaces ``ImGui_ImplSDL2_NewFrame`` on the API thread, which would query SDL.  The mouse position comes from
+/// motion events, and the mouse cursor isn't changed.
+void imgui_new_frame(const InputState& input, float delta_time)
+{
+    auto& io = ImGui::GetIO();
+    io.DisplaySize = ImVec2(float(input.window_width), float(input.window_height));
+    if (input.window_width > 0 && input.window_height > 0) {
+        io.DisplayFramebufferScale = ImVec2(float(input.drawable_width) / float(input.window_width),
+            float(input.drawable_height) / float(input.window_height));
+    }
+    io.DeltaTime = std::max(delta_time, 1e-4f);
+}
+
+/// SDL events and input state polled on the main thread for the API thread, when rendering on a separate thread.
+/// Clipboard requests of the API thread go the other way.
+struct EventQueue {
+    void push(const SDL_Event& ev)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        events_.push_back(ev);
+    }
+
+    void set_input(const InputState& input)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        input_ = input;
+    }
+
+    /// Appends all queued events to ``out`` and clears the queue, ``input`` is set to the latest input state
+    void drain(std::vector<SDL_Event>& out, InputState& input)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        out.insert(out.end(), events_.begin(), events_.end());
+        events_.clear();
+        input = input_;
+    }
+
+    /// Gets the clipboard text, blocking until the main thread serves the request.  The text stays valid until
+    /// the next call.
+    const char* get_clipboard()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        clipboard_requested_ = true;
+        clipboard_cv_.wait(lock, [this] { return !clipboard_requested_; });
+        return clipboard_.c_str();
+    }
+
+    /// Queues clipboard text for the main thread to set
+    void set_clipboard(const char* text)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_clipboard_ = text ? text : "";
+    }
+
+    /// Sets queued clipboard text and serves a pending request, on the main thread
+    void serve_clipboard()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_clipboard_) {
+            SDL_SetClipboardText(pending_clipboard_->c_str());
+            pending_clipboard_.reset();
+        }
+        if (clipboard_requested_) {
+            char* text = SDL_GetClipboardText();
+            clipboard_ = text ? text : "";
+            SDL_free(text);
+            clipboard_requested_ = false;
+            clipboard_cv_.notify_one();
+        }
+    }
+
+    std::mutex mutex_;
+    std::vector<SDL_Event> events_;
+    InputState input_;
+    std::condition_variable clipboard_cv_;
+    std::string clipboard_;
+    std::optional<std::string> pending_clipboard_;
+    bool clipboard_requested_ = false;
+};
+
 auto extract_usage = R"eof(usage: mudl extract <resref>
 )eof";
 
+auto bounds_usage = R"eof(usage: mudl bounds <resref> [<animation> [<milliseconds>]]
+)eof";
+
 int main(int argc, char** argv)
 {
     nw::init_logger(argc, argv);
@@ -63,7 +198,42 @@ int main(int argc, char** argv)
             return 1;
         }
         extract(std::string_view(argv[2]));
+    } else if (argc > 1 && "bounds"sv == argv[1]) {
+        if (argc < 3) {
+            std::cout << bounds_usage;
+            return 1;
+        }
+        std::string_view animation = argc > 3 ? argv[3] : "";
+        int32_t time = argc > 4 ? std::atoi(argv[4]) : 0;
+        return bounds(argv[2], animation, time) ? 0 : 1;
     } else {
+        bool render_thread = false;
+        int max_encoders = 0;
+        s_models.bake_dir_ = "cache";
+        for (int i = 1; i < argc; ++i) {
+            if ("--render-thread"sv == argv[i]) {
+                render_thread = true;
+            } else if ("--encoders"sv == argv[i] && i + 1 < argc) {
+                max_encoders = std::atoi(argv[++i]);
+            } else if ("--texture-budget"sv == argv[i] && i + 1 < argc) {
+                s_textures.budget_ = size_t(std::max(std::atoi(argv[++i]), 0)) * 1024 * 1024;
+            } else if ("--model-budget"sv == argv[i] && i + 1 < argc) {
+                s_models.budget_ = size_t(std::max(std::atoi(argv[++i]), 0)) * 1024 * 1024;
+            } else if ("--bake-dir"sv == argv[i] && i + 1 < argc) {
+                s_models.bake_dir_ = argv[++i];
+            } else {
+                std::cout << usage;
+                return 1;
+            }
+        }
+#if BX_PLATFORM_EMSCRIPTEN
+        if (render_thread) {
+            LOG_F(ERROR, "Render thread unsupported on this platform");
+            return 1;
+        }
+#endif // BX_PLATFORM_EMSCRIPTEN
+        EventQueue event_queue;
+
         // NWN Textures are pre-flipped, bgfx flips them, I guess, so we got to flip back before the flip..
         stbi_set_flip_vertically_on_load(true);
 
@@ -83,22 +253,6 @@ int main(int argc, char** argv)
             return 1;
         }
 
-        Node::layout.begin()
-            .add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
-            .add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Float)
-            .add(bgfx::Attrib::Normal, 3, bgfx::AttribType::Float)
-            .add(bgfx::Attrib::Tangent, 4, bgfx::AttribType::Float)
-            .end();
-
-        Skin::layout.begin()
-            .add(bgfx::Attrib::Position, 3, bgfx::AttribType::Float)
-            .add(bgfx::Attrib::TexCoord0, 2, bgfx::AttribType::Float)
-            .add(bgfx::Attrib::Normal, 3, bgfx::AttribType::Float)
-            .add(bgfx::Attrib::Tangent, 4, bgfx::AttribType::Float)
-            .add(bgfx::Attrib::Indices, 4, bgfx::AttribType::Int16)
-            .add(bgfx::Attrib::Weight, 4, bgfx::AttribType::Float)
-            .end();
-
 #if !BX_PLATFORM_EMSCRIPTEN
         SDL_SysWMinfo wmi;
         SDL_VERSION(&wmi.version);
@@ -108,37 +262,15 @@ int main(int argc, char** argv)
                 SDL_GetError());
             return 1;
         }
-        bgfx::renderFrame(); // single threaded mode
-#endif                       // !BX_PLATFORM_EMSCRIPTEN
-
-        bgfx::PlatformData pd{};
-#if BX_PLATFORM_WINDOWS
-        pd.nwh = wmi.info.win.window;
-#elif BX_PLATFORM_OSX
-        pd.nwh = wmi.info.cocoa.window;
-#elif BX_PLATFORM_LINUX
-        pd.ndt = wmi.info.x11.display;
-        pd.nwh = (void*)(uintptr_t)wmi.info.x11.window;
-#elif BX_PLATFORM_EMSCRIPTEN
-        pd.nwh = (void*)"#canvas";
-#endif // BX_PLATFORM_WINDOWS ? BX_PLATFORM_OSX ? BX_PLATFORM_LINUX ?
-       // BX_PLATFORM_EMSCRIPTEN
-
-        bgfx::Init bgfx_init;
-        bgfx_init.type = bgfx::RendererType::Count; // auto choose renderer
-        bgfx_init.resolution.width = width;
-        bgfx_init.resolution.height = height;
-        bgfx_init.resolution.reset = BGFX_RESET_VSYNC;
-        bgfx_init.platformData = pd;
-        bgfx::init(bgfx_init);
-        s_textures.load_placeholder();
+        // Makes this the render thread, so bgfx won't create one. Single threaded unless the API runs on another
+        bgfx::renderFrame();
+#endif // !BX_PLATFORM_EMSCRIPTEN
 
+        // The SDL backend creates cursors and sets hints, so it's set up and shut down here on the main thread
         ImGui::CreateContext();
         auto& io = ImGui::GetIO();
         io.ConfigFlags |= ImGuiConfigFlags_DockingEnable;
         ImGui::StyleColorsDark();
-
-        ImGui_Implbgfx_Init(255);
 #if BX_PLATFORM_WINDOWS
         ImGui_ImplSDL2_InitForD3D(window);
 #elif BX_PLATFORM_OSX
@@ -147,198 +279,369 @@ int main(int argc, char** argv)
         ImGui_ImplSDL2_InitForOpenGL(window, nullptr);
 #endif // BX_PLATFORM_WINDOWS ? BX_PLATFORM_OSX ? BX_PLATFORM_LINUX ?
        // BX_PLATFORM_EMSCRIPTEN
-
-        nw::ByteArray vs_mudl_bytes = nw::ByteArray::from_file(get_shader_path() / "vs_mudl.bin");
-        if (vs_mudl_bytes.size() == 0) {
-            return 1;
-        }
-        nw::ByteArray vs_skin_mudl_bytes = nw::ByteArray::from_file(get_shader_path() / "vs_skin_mudl.bin");
-        if (vs_mudl_bytes.size() == 0) {
-            return 1;
-        }
-        nw::ByteArray fs_mudl_bytes = nw::ByteArray::from_file(get_shader_path() / "fs_mudl.bin");
-        if (fs_mudl_bytes.size() == 0) {
-            return 1;
+        if (render_thread) {
+            io.ClipboardUserData = &event_queue;
+            io.GetClipboardTextFn = [](void* user) { return static_cast<EventQueue*>(user)->get_clipboard(); };
+            io.SetClipboardTextFn = [](void* user, const char* text) {
+                static_cast<EventQueue*>(user)->set_clipboard(text);
+            };
         }
 
-        auto vs_mudl_shd_handle = bgfx::createShader(bgfx::makeRef(vs_mudl_bytes.data(),
-            uint32_t(vs_mudl_bytes.size())));
-        auto vs_skin_smudl_shd_handle = bgfx::createShader(bgfx::makeRef(vs_skin_mudl_bytes.data(),
-            uint32_t(vs_mudl_bytes.size())));
-        auto fs_mudl_shd_handle = bgfx::createShader(bgfx::makeRef(fs_mudl_bytes.data(),
-            uint32_t(fs_mudl_bytes.size())));
-
-        Node::skinned_program = bgfx::createProgram(vs_skin_smudl_shd_handle, fs_mudl_shd_handle, true);
-        auto program = bgfx::createProgram(vs_mudl_shd_handle, fs_mudl_shd_handle, true);
-        bgfx::setViewClear(
-            0, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, 0xD3D3D3FF, 1.0f, 0);
-        bgfx::setViewRect(0, 0, 0, uint16_t(width), uint16_t(height));
-
-        absl::btree_set<std::string> models;
-        std::string selected_model;
-        auto cb = [&models](const nw::Resource& res) {
-            if (res.type == nw::ResourceType::mdl) {
-                models.emplace(res.resref.view());
-            }
+        // The caches are globals and would otherwise destroy their bgfx resources after bgfx is gone
+        auto shutdown = []() {
+            s_workers().wait();
+            s_models.clear();
+            s_textures.clear();
+            bgfx::shutdown();
         };
-        nw::kernel::resman().visit(cb);
 
-        Model* model = s_models.load("c_aribeth");
-        if (!model) {
-            LOG_F(FATAL, "uanble to load model.");
-        } else {
-            selected_model = "c_aribeth";
-        }
+        // Everything touching the bgfx API runs here, on the main thread or on its own thread with the main
+        // thread rendering
+        auto run = [&]() -> int {
+            bgfx::PlatformData pd{};
+#if BX_PLATFORM_WINDOWS
+            pd.nwh = wmi.info.win.window;
+#elif BX_PLATFORM_OSX
+            pd.nwh = wmi.info.cocoa.window;
+#elif BX_PLATFORM_LINUX
+            pd.ndt = wmi.info.x11.display;
+            pd.nwh = (void*)(uintptr_t)wmi.info.x11.window;
+#elif BX_PLATFORM_EMSCRIPTEN
+            pd.nwh = (void*)"#canvas";
+#endif // BX_PLATFORM_WINDOWS ? BX_PLATFORM_OSX ? BX_PLATFORM_LINUX ?
+       // BX_PLATFORM_EMSCRIPTEN
+
+            bgfx::Init bgfx_init;
+            bgfx_init.type = bgfx::RendererType::Count; // auto choose renderer
+            bgfx_init.resolution.width = width;
+            bgfx_init.resolution.height = height;
+            bgfx_init.resolution.reset = BGFX_RESET_VSYNC | BGFX_RESET_MAXANISOTROPY;
+            bgfx_init.platformData = pd;
+            if (max_encoders > 0) {
+                bgfx_init.limits.maxEncoders = uint16_t(max_encoders);
+            }
+            bgfx::init(bgfx_init);
+            init_vertex_layouts();
+            s_textures.load_placeholder();
+            s_textures.pool_ = &s_workers();
 
-        absl::btree_set<std::string> animations;
-        std::string selected_animation; // = "walk";
+            ImGui_Implbgfx_Init(255);
 
-        auto* sm = model->mdl_;
-        while (sm) {
-            for (const auto& it : sm->animations) {
-                animations.insert(it->name);
+            nw::ByteArray vs_mudl_bytes = nw::ByteArray::from_file(get_shader_path() / "vs_mudl.bin");
+            if (vs_mudl_bytes.size() == 0) {
+                shutdown();
+                return 1;
+            }
+            nw::ByteArray vs_skin_mudl_bytes = nw::ByteArray::from_file(get_shader_path() / "vs_skin_mudl.bin");
+            if (vs_mudl_bytes.size() == 0) {
+                shutdown();
+                return 1;
+            }
+            nw::ByteArray fs_mudl_bytes = nw::ByteArray::from_file(get_shader_path() / "fs_mudl.bin");
+            if (fs_mudl_bytes.size() == 0) {
+                shutdown();
+                return 1;
             }
-            if (!sm->supermodel) { break; }
-            sm = &sm->supermodel->model;
-        }
 
-        // if (!model->load_animation(selected_animation)) {
-        //     LOG_F(ERROR, "Failed to load animation: {}", selected_animation);
-        // }
-
-        int prev_mouse_x = 0;
-        int prev_mouse_y = 0;
-        float cam_pitch = 0.0f;
-        float cam_yaw = 0.0f;
-        float rot_scale = 0.01f;
-        glm::vec3 camera_position{0.0f, 1.5f, -2.5f};
-        glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
-        glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
-
-        int32_t delta_time = 0;
-        bool exit = false;
-        while (!exit) {
-            auto start_frame = std::chrono::steady_clock::now();
-            bgfx::touch(0);
-
-            for (SDL_Event ev; SDL_PollEvent(&ev) != 0;) {
-                ImGui_ImplSDL2_ProcessEvent(&ev);
-                if (ev.type == SDL_QUIT) {
-                    exit = true;
-                    break;
-                } else if (ev.type == SDL_WINDOWEVENT) {
-                    const SDL_WindowEvent& wev = ev.window;
-                    switch (wev.event) {
-                    case SDL_WINDOWEVENT_RESIZED:
-                    case SDL_WINDOWEVENT_SIZE_CHANGED:
-                        width = wev.data1;
-                        height = wev.data2;
-                        bgfx::reset(wev.data1, wev.data2, BGFX_RESET_VSYNC);
-                        bgfx::setViewRect(0, 0, 0, uint16_t(width), uint16_t(height));
-                        break;
+            auto vs_mudl_shd_handle = bgfx::createShader(bgfx::makeRef(vs_mudl_bytes.data(),
+                uint32_t(vs_mudl_bytes.size())));
+            auto vs_skin_smudl_shd_handle = bgfx::createShader(bgfx::makeRef(vs_skin_mudl_bytes.data(),
+                uint32_t(vs_mudl_bytes.size())));
+            auto fs_mudl_shd_handle = bgfx::createShader(bgfx::makeRef(fs_mudl_bytes.data(),
+                uint32_t(fs_mudl_bytes.size())));
+
+            Node::skinned_program = bgfx::createProgram(vs_skin_smudl_shd_handle, fs_mudl_shd_handle, true);
+
+            // Joint palettes are read from an RGBA32F texture in the vertex shader when supported
+            if (bgfx::getCaps()->formats[bgfx::TextureFormat::RGBA32F] & BGFX_CAPS_FORMAT_TEXTURE_VERTEX) {
+                Skin::palette_program = load_program("vs_skin_palette_mudl", "fs_mudl");
+            }
+            if (!bgfx::isValid(Skin::palette_program)) {
+                LOG_F(INFO, "Joint palette textures unsupported, falling back to uniforms");
+            }
+
+            auto program = bgfx::createProgram(vs_mudl_shd_handle, fs_mudl_shd_handle, true);
+
+            if (bgfx::getCaps()->supported & BGFX_CAPS_INSTANCING) {
+                Node::instanced_program = load_program("vs_mudl_instanced", "fs_mudl");
+                Node::skinned_instanced_program = load_program("vs_skin_mudl_instanced", "fs_mudl");
+                if (bgfx::isValid(Skin::palette_program)) {
+                    Skin::palette_instanced_program = load_program("vs_skin_palette_mudl_instanced", "fs_mudl");
+                }
+            }
+
+            bgfx::setViewClear(
+                0, BGFX_CLEAR_COLOR | BGFX_CLEAR_DEPTH, 0xD3D3D3FF, 1.0f, 0);
+            bgfx::setViewRect(0, 0, 0, uint16_t(width), uint16_t(height));
+
+            absl::btree_set<std::string> models;
+            std::string selected_model;
+            auto cb = [&models](const nw::Resource& res) {
+                if (res.type == nw::ResourceType::mdl) {
+                    models.emplace(res.resref.view());
+                }
+            };
+            {
+                std::lock_guard<std::mutex> lock(resman_mutex());
+                nw::kernel::resman().visit(cb);
+            }
+
+            Model* model = s_models.load("c_aribeth");
+            if (!model) {
+                LOG_F(FATAL, "uanble to load model.");
+            } else {
+                selected_model = "c_aribeth";
+            }
+
+            absl::btree_set<std::string> animations;
+            std::string selected_animation; // = "walk";
+
+            for (const auto& [_, anim] : model->animation_index_) {
+                animations.insert(anim->name);
+            }
+
+            // if (!model->load_animation(selected_animation)) {
+            //     LOG_F(ERROR, "Failed to load animation: {}", selected_animation);
+            // }
+
+            int prev_mouse_x = 0;
+            int prev_mouse_y = 0;
+            float cam_pitch = 0.0f;
+            float cam_yaw = 0.0f;
+            float rot_scale = 0.01f;
+            glm::vec3 camera_position{0.0f, 1.5f, -2.5f};
+            glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
+            glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
+
+            int num_instances = 1;
+            InstanceBatcher batcher;
+            bool frustum_culling = true;
+            CullStats cull_stats;
+            bool use_lods = true;
+            LodSelector lod_selector;
+            RenderQueue queue;
+            RenderQueueStats queue_stats;
+            const char* texture_filters[] = {"Trilinear", "Bilinear", "Anisotropic", "Point"};
+            const uint32_t texture_filter_flags[] = {BGFX_SAMPLER_NONE, BGFX_SAMPLER_MIP_POINT,
+                BGFX_SAMPLER_MIN_ANISOTROPIC | BGFX_SAMPLER_MAG_ANISOTROPIC, BGFX_SAMPLER_POINT};
+            int texture_filter = 0;
+
+            // Model being loaded in the background, the current one is drawn until it's ready
+            ModelPayload* pending = nullptr;
+            std::string pending_model;
+
+            std::vector<SDL_Event> events;
+            InputState input;
+            int32_t delta_time = 0;
+            bool exit = false;
+            while (!exit) {
+                auto start_frame = std::chrono::steady_clock::now();
+                bgfx::touch(0);
+
+                events.clear();
+                if (render_thread) {
+                    event_queue.drain(events, input);
+                } else {
+                    for (SDL_Event ev; SDL_PollEvent(&ev) != 0;) {
+                        events.push_back(ev);
                     }
-                } else if (ev.type == SDL_KEYDOWN) {
-                    const float cameraSpeed = 0.1f;
-                    switch (ev.key.keysym.sym) {
-                    case SDLK_w:
-                        camera_position -= cameraSpeed * cameraFront;
-                        break;
-                    case SDLK_a:
-                        camera_position -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
-                        break;
-                    case SDLK_s:
-                        camera_position += cameraSpeed * cameraFront;
-                        break;
-                    case SDLK_d:
-                        camera_position += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+                    input = sample_input(window);
+                }
+
+                for (auto& ev : events) {
+                    ImGui_ImplSDL2_ProcessEvent(&ev);
+                    if (ev.type == SDL_QUIT) {
+                        exit = true;
                         break;
+                    } else if (ev.type == SDL_WINDOWEVENT) {
+                        const SDL_WindowEvent& wev = ev.window;
+                        switch (wev.event) {
+                        case SDL_WINDOWEVENT_RESIZED:
+                        case SDL_WINDOWEVENT_SIZE_CHANGED:
+                            width = wev.data1;
+                            height = wev.data2;
+                            bgfx::reset(wev.data1, wev.data2, BGFX_RESET_VSYNC | BGFX_RESET_MAXANISOTROPY);
+                            bgfx::setViewRect(0, 0, 0, uint16_t(width), uint16_t(height));
+                            break;
+                        }
+                    } else if (ev.type == SDL_KEYDOWN) {
+                        const float cameraSpeed = 0.1f;
+                        switch (ev.key.keysym.sym) {
+                        case SDLK_w:
+                            camera_position -= cameraSpeed * cameraFront;
+                            break;
+                        case SDLK_a:
+                            camera_position -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+                            break;
+                        case SDLK_s:
+                            camera_position += cameraSpeed * cameraFront;
+                            break;
+                        case SDLK_d:
+                            camera_position += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+                            break;
+                        }
                     }
                 }
-            }
 
-            ImGui_Implbgfx_NewFrame();
-            ImGui_ImplSDL2_NewFrame();
-            ImGui::NewFrame();
-
-            ImGui::Begin("Models");
-            ImGui::BeginListBox("Models", {-FLT_MIN, -FLT_MIN});
-            for (const auto& it : models) {
-                if (ImGui::Selectable(it.c_str(), selected_model == it)) {
-                    auto new_model = s_models.load(it);
-                    if (new_model) {
-                        model = new_model;
-                        selected_model = it;
-                        animations.clear();
-                        sm = model->mdl_;
-                        while (sm) {
-                            for (const auto& anim : sm->animations) {
-                                animations.insert(anim->name);
+                ImGui_Implbgfx_NewFrame();
+                if (render_thread) {
+                    imgui_new_frame(input, float(delta_time) / 1000.0f);
+                } else {
+                    ImGui_ImplSDL2_NewFrame();
+                }
+                ImGui::NewFrame();
+
+                ImGui::Begin("Models");
+                ImGui::BeginListBox("Models", {-FLT_MIN, -FLT_MIN});
+                for (const auto& it : models) {
+                    if (ImGui::Selectable(it.c_str(), selected_model == it || pending_model == it)) {
+                        if (pending) { s_models.release(pending_model); }
+                        pending = s_models.load_async(it, s_workers());
+                        pending_model = pending ? it : std::string{};
+                    }
+                }
+                ImGui::EndListBox();
+                ImGui::End();
+
+                s_models.update(std::chrono::milliseconds(4));
+                s_textures.update(8 * 1024 * 1024);
+                if (pending && pending->state_ == ModelLoadState::ready) {
+                    s_models.release(selected_model);
+                    model = pending->model_.get();
+                    selected_model = pending_model;
+                    animations.clear();
+                    for (const auto& [_, anim] : model->animation_index_) {
+                        animations.insert(anim->name);
+                    }
+                    pending = nullptr;
+                    pending_model.clear();
+                } else if (pending && pending->state_ == ModelLoadState::failed) {
+                    LOG_F(ERROR, "Failed to load model: {}", pending_model);
+                    s_models.release(pending_model);
+                    pending = nullptr;
+                    pending_model.clear();
+                }
+
+                if (animations.size()) {
+                    ImGui::Begin("Animations");
+                    for (const auto& anim : animations) {
+                        if (ImGui::Selectable(anim.c_str(), selected_animation == anim)) {
+                            selected_animation = anim;
+                            if (!model->load_animation(selected_animation)) {
+                                LOG_F(ERROR, "Failed to load animation: {}", selected_animation);
                             }
-                            if (!sm->supermodel) { break; }
-                            sm = &sm->supermodel->model;
                         }
                     }
+                    ImGui::End();
                 }
-            }
-            ImGui::EndListBox();
-            ImGui::End();
-
-            if (animations.size()) {
-                ImGui::Begin("Animations");
-                for (const auto& anim : animations) {
-                    if (ImGui::Selectable(anim.c_str(), selected_animation == anim)) {
-                        selected_animation = anim;
-                        if (!model->load_animation(selected_animation)) {
-                            LOG_F(ERROR, "Failed to load animation: {}", selected_animation);
-                        }
+
+                ImGui::Begin("Scene");
+                ImGui::SliderInt("Instances", &num_instances, 1, 400);
+                ImGui::Checkbox("Frustum culling", &frustum_culling);
+                ImGui::Text("Visible: %u, culled: %u", cull_stats.visible, cull_stats.culled);
+                ImGui::Checkbox("Levels of detail", &use_lods);
+                ImGui::SliderFloat("LOD pixel error", &lod_selector.max_pixel_error, 0.25f, 8.0f);
+                ImGui::Combo("Texture filter", &texture_filter, texture_filters, IM_ARRAYSIZE(texture_filters));
+                ImGui::Text("Draws: %u, state binds: %u, texture binds: %u", queue_stats.draws,
+                    queue_stats.state_binds, queue_stats.texture_binds);
+                ImGui::Text("Encoders: %u", queue_stats.encoders);
+                ImGui::Text("Textures: %zu MiB, budget %zu MiB", (s_textures.cpu_bytes_ + s_textures.gpu_bytes_) >> 20,
+                    s_textures.budget_ >> 20);
+                ImGui::Text("Models: %zu MiB, budget %zu MiB", s_models.bytes_ >> 20, s_models.budget_ >> 20);
+                ImGui::End();
+
+                ImGui::Render();
+                ImGui_Implbgfx_RenderDrawLists(ImGui::GetDrawData());
+
+                if (!ImGui::GetIO().WantCaptureMouse) {
+                    // simple input code for orbit camera
+                    int mouse_x = input.mouse_x, mouse_y = input.mouse_y;
+                    if ((input.mouse_buttons & SDL_BUTTON(SDL_BUTTON_LEFT)) != 0) {
+                        int delta_x = mouse_x - prev_mouse_x;
+                        int delta_y = mouse_y - prev_mouse_y;
+                        cam_yaw += float(-delta_x) * rot_scale;
+                        cam_pitch += float(-delta_y) * rot_scale;
                     }
+                    prev_mouse_x = mouse_x;
+                    prev_mouse_y = mouse_y;
                 }
-            }
 
-            ImGui::Render();
-            ImGui_Implbgfx_RenderDrawLists(ImGui::GetDrawData());
-
-            if (!ImGui::GetIO().WantCaptureMouse) {
-                // simple input code for orbit camera
-                int mouse_x, mouse_y;
-                const int buttons = SDL_GetMouseState(&mouse_x, &mouse_y);
-                if ((buttons & SDL_BUTTON(SDL_BUTTON_LEFT)) != 0) {
-                    int delta_x = mouse_x - prev_mouse_x;
-                    int delta_y = mouse_y - prev_mouse_y;
-                    cam_yaw += float(-delta_x) * rot_scale;
-                    cam_pitch += float(-delta_y) * rot_scale;
+                // Set view and projection matrix for view 0.
+                Frustum frustum;
+                {
+                    auto cam_rot = glm::yawPitchRoll(cam_yaw, cam_pitch, 0.0f);
+                    auto cam_translate = glm::translate(glm::mat4{1.0f}, camera_position);
+                    auto cam_trans = cam_translate * cam_rot;
+                    auto view = glm::inverse(cam_trans);
+                    auto proj = glm::perspectiveLH(glm::radians(60.f), float(width) / float(height), 0.1f, 100.0f);
+                    bgfx::setViewTransform(0, glm::value_ptr(view), glm::value_ptr(proj));
+                    frustum = Frustum::from_matrix(proj * view);
+                    lod_selector.eye = camera_position;
+                    lod_selector.projection_scale = float(height) / (2.0f * std::tan(glm::radians(60.f) / 2.0f));
                 }
-                prev_mouse_x = mouse_x;
-                prev_mouse_y = mouse_y;
-            }
 
-            // Set view and projection matrix for view 0.
-            {
-                auto cam_rot = glm::yawPitchRoll(cam_yaw, cam_pitch, 0.0f);
-                auto cam_translate = glm::translate(glm::mat4{1.0f}, camera_position);
-                auto cam_trans = cam_translate * cam_rot;
-                auto view = glm::inverse(cam_trans);
-                auto proj = glm::perspectiveLH(glm::radians(60.f), float(width) / float(height), 0.1f, 100.0f);
-                bgfx::setViewTransform(0, glm::value_ptr(view), glm::value_ptr(proj));
+                glm::mat4 mtx = glm::rotate(glm::mat4(1.0f), glm::radians(270.0f), {1.0f, 0.0f, 0.0f});
+                glm::rotate(mtx, glm::radians(90.0f), {0.0f, 0.0f, 1.0f});
+                model->update(delta_time);
+
+                // Lay instances out on a grid, centered on the first row
+                const float spacing = 1.5f;
+                int columns = int(std::ceil(std::sqrt(float(num_instances))));
+                for (int i = 0; i < num_instances; ++i) {
+                    glm::vec3 offset{(float(i % columns) - float(columns - 1) / 2.0f) * spacing, 0.0f, float(i / columns) * spacing};
+                    batcher.add(model, glm::translate(glm::mat4{1.0f}, offset) * mtx);
+                }
+                cull_stats = {};
+                batcher.submit(queue, 0, program, BGFX_STATE_MASK, frustum_culling ? &frustum : nullptr, &cull_stats,
+                    use_lods ? &lod_selector : nullptr);
+                batcher.clear();
+                queue.sampler_flags_ = texture_filter_flags[texture_filter];
+                queue.sort();
+                queue.submit(&s_workers());
+                queue_stats = queue.stats_;
+                queue.clear();
+
+                bgfx::frame();
+                auto end_frame = std::chrono::steady_clock::now();
+                delta_time = std::chrono::duration_cast<std::chrono::milliseconds>(end_frame - start_frame).count();
             }
 
-            glm::mat4 mtx = glm::rotate(glm::mat4(1.0f), glm::radians(270.0f), {1.0f, 0.0f, 0.0f});
-            glm::rotate(mtx, glm::radians(90.0f), {0.0f, 0.0f, 1.0f});
-            model->update(delta_time);
-            model->submit(0, program, mtx);
+            shutdown();
+            return 0;
+        };
 
-            bgfx::frame();
-            auto end_frame = std::chrono::steady_clock::now();
-            delta_time = std::chrono::duration_cast<std::chrono::milliseconds>(end_frame - start_frame).count();
+        int result = 0;
+        if (render_thread) {
+            std::atomic<bool> done{false};
+            std::thread api_thread([&]() {
+                result = run();
+                done = true;
+            });
+
+            // SDL events must be pumped on the thread that created the window.  A clipboard request stalls the
+            // API thread, so it's served at the latest when rendering times out.
+            while (!done) {
+                for (SDL_Event ev; SDL_PollEvent(&ev) != 0;) {
+                    event_queue.push(ev);
+                }
+                event_queue.set_input(sample_input(window));
+                event_queue.serve_clipboard();
+                bgfx::renderFrame(100);
+            }
+            api_thread.join();
+        } else {
+            result = run();
         }
 
-        bgfx::shutdown();
-
         while (bgfx::RenderFrame::NoContext != bgfx::renderFrame()) {
         };
 
+        ImGui_ImplSDL2_Shutdown();
+        ImGui::DestroyContext();
+
         SDL_DestroyWindow(window);
         SDL_Quit();
+        return result;
     }
 
     return 0;
@@ -0,0 +1,265 @@
+#include "meshopt.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+
+namespace {
+
+// Forsyth, "Linear-Speed Vertex Cache Optimisation", with the cache size and constants from the paper
+constexpr int forsyth_cache_size = 32;
+constexpr float cache_decay_power = 1.5f;
+constexpr float last_tri_score = 0.75f;
+constexpr float valence_boost_scale = 2.0f;
+constexpr float valence_boost_power = 0.5f;
+
+float vertex_score(int cache_position, uint32_t remaining)
+{
+    if (remaining == 0) { return -1.0f; }
+
+    float score = 0.0f;
+    if (cache_position >= 0) {
+        if (cache_position < 3) {
+            score = last_tri_score;
+        } else {
+            float scaler = 1.0f / float(forsyth_cache_size - 3);
+            score = std::pow(1.0f - float(cache_position - 3) * scaler, cache_decay_power);
+        }
+    }
+    return score + valence_boost_scale * std::pow(float(remaining), -valence_boost_power);
+}
+
+} // namespace
+
+float acmr(std::span<const uint16_t> indices, size_t vertex_count, size_t cache_size)
+{
+    if (indices.size() < 3) { return 0.0f; }
+
+    // FIFO cache, ``stamp`` is the miss count when a vertex entered the cache
+    std::vector<size_t> stamp(vertex_count, 0);
+    size_t misses = 0;
+    for (auto idx : indices) {
+        if (idx >= vertex_count) { continue; }
+        if (stamp[idx] == 0 || misses - stamp[idx] + 1 > cache_size) {
+            ++misses;
+            stamp[idx] = misses;
+        }
+    }
+    return float(misses) / float(indices.size() / 3);
+}
+
+void optimize_vertex_cache(std::span<uint16_t> indices, size_t vertex_count)
+{
+    const size_t tri_count = indices.size() / 3;
+    if (tri_count < 2) { return; }
+
+    // Vertex to triangle adjacency as offsets into ``adjacency``
+    std::vector<uint32_t> remaining(vertex_count, 0);
+    for (size_t i = 0; i < tri_count * 3; ++i) {
+        if (indices[i] >= vertex_count) { return; }
+        ++remaining[indices[i]];
+    }
+    std::vector<uint32_t> offsets(vertex_count + 1, 0);
+    for (size_t v = 0; v < vertex_count; ++v) {
+        offsets[v + 1] = offsets[v] + remaining[v];
+    }
+    std::vector<uint32_t> adjacency(tri_count * 3);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < tri_count; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            adjacency[fill[indices[t * 3 + k]]++] = uint32_t(t);
+        }
+    }
+
+    std::vector<int> cache_position(vertex_count, -1);
+    std::vector<float> vscore(vertex_count);
+    for (size_t v = 0; v < vertex_count; ++v) {
+        vscore[v] = vertex_score(-1, remaining[v]);
+    }
+
+    std::vector<float> tscore(tri_count);
+    std::vector<uint8_t> emitted(tri_count, 0);
+    for (size_t t = 0; t < tri_count; ++t) {
+        tscore[t] = vscore[indices[t * 3]] + vscore[indices[t * 3 + 1]] + vscore[indices[t * 3 + 2]];
+    }
+
+    // Live triangle lists per vertex, emitted triangles are swapped past the end
+    std::vector<uint32_t> live(remaining);
+
+    std::vector<uint16_t> result;
+    result.reserve(tri_count * 3);
+
+    std::array<int, forsyth_cache_size + 3> cache;
+    std::array<int, forsyth_cache_size + 3> next_cache;
+    int cache_count = 0;
+
+    // Start from the triangle that scores best, i.e. whose vertices have the fewest triangles left
+    size_t input_cursor = 0;
+    int64_t best = std::max_element(tscore.begin(), tscore.end()) - tscore.begin();
+    float best_score = tscore[size_t(best)];
+    for (size_t emit = 0; emit < tri_count; ++emit) {
+        if (best < 0) {
+            // No candidate in cache, fall back to the next triangle in input order
+            while (emitted[input_cursor]) {
+                ++input_cursor;
+            }
+            best = int64_t(input_cursor);
+        }
+
+        emitted[best] = 1;
+        const uint16_t* tri = &indices[size_t(best) * 3];
+        result.insert(result.end(), tri, tri + 3);
+
+        // Remove triangle from its vertices' live lists
+        for (int k = 0; k < 3; ++k) {
+            auto v = tri[k];
+            auto begin = adjacency.begin() + offsets[v];
+            auto end = begin + live[v];
+            auto it = std::find(begin, end, uint32_t(best));
+            if (it != end) {
+                std::iter_swap(it, end - 1);
+                --live[v];
+            }
+        }
+
+        // Push triangle vertices to the front of the LRU cache
+        int next_count = 0;
+        for (int k = 0; k < 3; ++k) {
+            next_cache[next_count++] = tri[k];
+        }
+        for (int i = 0; i < cache_count; ++i) {
+            int v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                next_cache[next_count++] = v;
+            }
+        }
+
+        // Update scores of everything that was in the cache, including vertices just evicted
+        for (int i = 0; i < next_count; ++i) {
+            int v = next_cache[i];
+            cache_position[v] = i < forsyth_cache_size ? i : -1;
+        }
+        for (int i = 0; i < next_count; ++i) {
+            int v = next_cache[i];
+            float score = vertex_score(cache_position[v], live[v]);
+            float delta = score - vscore[v];
+            vscore[v] = score;
+            for (uint32_t j = 0; j < live[v]; ++j) {
+                tscore[adjacency[offsets[v] + j]] += delta;
+            }
+        }
+
+        cache_count = std::min(next_count, forsyth_cache_size);
+        std::copy(next_cache.begin(), next_cache.begin() + cache_count, cache.begin());
+
+        // Next triangle is the best among those touching the cache
+        best = -1;
+        best_score = -1.0f;
+        for (int i = 0; i < cache_count; ++i) {
+            int v = cache[i];
+            for (uint32_t j = 0; j < live[v]; ++j) {
+                auto t = adjacency[offsets[v] + j];
+                if (tscore[t] > best_score) {
+                    best_score = tscore[t];
+                    best = t;
+                }
+            }
+        }
+    }
+
+    std::copy(result.begin(), result.end(), indices.begin());
+}
+
+void optimize_overdraw(std::span<uint16_t> indices, std::span<const glm::vec3> positions, float threshold)
+{
+    const size_t tri_count = indices.size() / 3;
+    if (tri_count < 2) { return; }
+    for (auto idx : indices) {
+        if (idx >= positions.size()) { return; }
+    }
+
+    // Clusters start wherever a triangle misses the cache for all of its vertices, reordering at those
+    // points keeps the cache behaviour within each cluster intact
+    constexpr size_t cache_size = 16;
+    std::vector<size_t> stamp(positions.size(), 0);
+    std::vector<uint32_t> clusters;
+    size_t misses = 0;
+    for (size_t t = 0; t < tri_count; ++t) {
+        int tri_misses = 0;
+        for (int k = 0; k < 3; ++k) {
+            auto idx = indices[t * 3 + k];
+            if (stamp[idx] == 0 || misses - stamp[idx] + 1 > cache_size) {
+                ++misses;
+                ++tri_misses;
+                stamp[idx] = misses;
+            }
+        }
+        if (t == 0 || tri_misses == 3) { clusters.push_back(uint32_t(t)); }
+    }
+    if (clusters.size() < 2) { return; }
+    clusters.push_back(uint32_t(tri_count));
+
+    glm::vec3 mesh_center{0.0f};
+    float mesh_area = 0.0f;
+    std::vector<float> sort_keys(clusters.size() - 1);
+    std::vector<glm::vec3> centers(clusters.size() - 1), normals(clusters.size() - 1);
+    for (size_t c = 0; c + 1 < clusters.size(); ++c) {
+        glm::vec3 center{0.0f}, normal{0.0f};
+        float area = 0.0f;
+        for (uint32_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+            const auto& p0 = positions[indices[t * 3]];
+            const auto& p1 = positions[indices[t * 3 + 1]];
+            const auto& p2 = positions[indices[t * 3 + 2]];
+            auto n = glm::cross(p1 - p0, p2 - p0);
+            float a = glm::length(n);
+            center += (p0 + p1 + p2) * (a / 3.0f);
+            normal += n;
+            area += a;
+        }
+        mesh_center += center;
+        mesh_area += area;
+        centers[c] = area > 0.0f ? center / area : positions[indices[clusters[c] * 3]];
+        normals[c] = glm::length(normal) > 0.0f ? glm::normalize(normal) : normal;
+    }
+    mesh_center = mesh_area > 0.0f ? mesh_center / mesh_area : mesh_center;
+
+    // Clusters facing away from the center are more likely to occlude others, draw those first
+    for (size_t c = 0; c < sort_keys.size(); ++c) {
+        sort_keys[c] = glm::dot(centers[c] - mesh_center, normals[c]);
+    }
+    std::vector<uint32_t> order(sort_keys.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return sort_keys[a] > sort_keys[b];
+    });
+
+    std::vector<uint16_t> result;
+    result.reserve(indices.size());
+    for (auto c : order) {
+        result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+    }
+
+    if (acmr(result, positions.size()) > acmr(indices, positions.size()) * threshold) { return; }
+    std::copy(result.begin(), result.end(), indices.begin());
+}
+
+std::vector<uint16_t> optimize_vertex_fetch(std::span<uint16_t> indices, size_t vertex_count)
+{
+    // A full range of 65536 vertices uses every 16 bit index, so track unmapped vertices separately
+    std::vector<uint16_t> remap(vertex_count, 0);
+    std::vector<bool> mapped(vertex_count, false);
+    uint16_t next = 0;
+    for (auto& idx : indices) {
+        if (idx >= vertex_count) { continue; }
+        if (!mapped[idx]) {
+            remap[idx] = next++;
+            mapped[idx] = true;
+        }
+        idx = remap[idx];
+    }
+    for (size_t i = 0; i < vertex_count; ++i) {
+        if (!mapped[i]) { remap[i] = next++; }
+    }
+    return remap;
+}
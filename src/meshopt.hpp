@@ -0,0 +1,54 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+
+/// Average cache miss ratio, i.e. transformed vertices per triangle, of a FIFO post-transform cache.
+/// 0.5 is the best possible for a regular grid, 3 the worst.
+float acmr(std::span<const uint16_t> indices, size_t vertex_count, size_t cache_size = 16);
+
+/// Reorders triangles for post-transform cache locality with Forsyth's linear-speed algorithm
+void optimize_vertex_cache(std::span<uint16_t> indices, size_t vertex_count);
+
+/// Reorders clusters of cache optimized triangles so that outward facing ones are drawn first, reducing
+/// overdraw.  Clusters are split where the cache restarts, so ACMR grows by at most ``threshold``.
+void optimize_overdraw(std::span<uint16_t> indices, std::span<const glm::vec3> positions, float threshold = 1.05f);
+
+/// Renumbers vertices in order of first use, returns remap table from old to new vertex index.
+/// Unreferenced vertices are moved to the end.
+std::vector<uint16_t> optimize_vertex_fetch(std::span<uint16_t> indices, size_t vertex_count);
+
+/// Reorders ``vertices`` with a remap table from ``optimize_vertex_fetch``
+template <typename Vertex>
+void remap_vertices(std::vector<Vertex>& vertices, std::span<const uint16_t> remap)
+{
+    std::vector<Vertex> result(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        result[remap[i]] = vertices[i];
+    }
+    vertices = std::move(result);
+}
+
+/// Runs all optimizations on a mesh in place, returns ACMR before and after
+template <typename Vertex>
+std::pair<float, float> optimize_mesh(std::vector<uint16_t>& indices, std::vector<Vertex>& vertices)
+{
+    float before = acmr(indices, vertices.size());
+    optimize_vertex_cache(indices, vertices.size());
+
+    std::vector<glm::vec3> positions;
+    positions.reserve(vertices.size());
+    for (const auto& v : vertices) {
+        positions.push_back(v.position);
+    }
+    optimize_overdraw(indices, positions);
+
+    auto remap = optimize_vertex_fetch(indices, vertices.size());
+    remap_vertices(vertices, remap);
+    return {before, acmr(indices, vertices.size())};
+}
@@ -0,0 +1,164 @@
+#include "mipmap.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <xmmintrin.h>
+#define MUDL_MIPMAP_SSE 1
+#endif
+
+namespace {
+
+// Resolution of the linear to sRGB table, finer than 8 bits so dark values round correctly
+constexpr size_t linear_steps = 4096;
+
+struct SrgbTables {
+    std::array<float, 256> to_linear;
+    std::array<uint8_t, linear_steps + 1> to_srgb;
+
+    SrgbTables()
+    {
+        for (size_t i = 0; i < to_linear.size(); ++i) {
+            float c = float(i) / 255.0f;
+            to_linear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for (size_t i = 0; i < to_srgb.size(); ++i) {
+            float l = float(i) / float(linear_steps);
+            float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+            to_srgb[i] = uint8_t(std::lround(std::clamp(c, 0.0f, 1.0f) * 255.0f));
+        }
+    }
+};
+
+const SrgbTables& tables()
+{
+    static SrgbTables result;
+    return result;
+}
+
+// Averages four RGBA pixels
+inline void average4(const float* a, const float* b, const float* c, const float* d, float* out)
+{
+#ifdef MUDL_MIPMAP_SSE
+    __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(a), _mm_loadu_ps(b)), _mm_add_ps(_mm_loadu_ps(c), _mm_loadu_ps(d)));
+    _mm_storeu_ps(out, _mm_mul_ps(sum, _mm_set1_ps(0.25f)));
+#else
+    for (int k = 0; k < 4; ++k) {
+        out[k] = (a[k] + b[k] + c[k] + d[k]) * 0.25f;
+    }
+#endif
+}
+
+// Source texels along one axis that a texel of the next level averages.  Halving an odd size would drop the
+// last texel, so the last texel of the next level averages three.
+struct Footprint {
+    uint32_t first;
+    uint32_t count;
+};
+
+inline Footprint footprint(uint32_t x, uint32_t size)
+{
+    if (size == 1) { return {0, 1}; }
+    if (size % 2 == 1 && 2 * x + 3 == size) { return {2 * x, 3}; }
+    return {2 * x, 2};
+}
+
+// Box filters a footprint of up to 3x3 RGBA pixels
+inline void average(const float* src, uint32_t stride, Footprint fx, Footprint fy, float* out)
+{
+    float sum[4] = {};
+    for (uint32_t j = 0; j < fy.count; ++j) {
+        const float* row = src + size_t(fy.first + j) * stride * 4;
+        for (uint32_t i = 0; i < fx.count; ++i) {
+            for (int k = 0; k < 4; ++k) {
+                sum[k] += row[size_t(fx.first + i) * 4 + k];
+            }
+        }
+    }
+    float scale = 1.0f / float(fx.count * fy.count);
+    for (int k = 0; k < 4; ++k) {
+        out[k] = sum[k] * scale;
+    }
+}
+
+void encode(const std::vector<float>& linear, size_t pixels, uint32_t channels, uint8_t* out)
+{
+    const auto& t = tables();
+    for (size_t i = 0; i < pixels; ++i) {
+        const float* p = &linear[i * 4];
+        for (uint32_t k = 0; k < 3; ++k) {
+            out[i * channels + k] = t.to_srgb[size_t(p[k] * float(linear_steps) + 0.5f)];
+        }
+        if (channels == 4) { out[i * 4 + 3] = uint8_t(p[3] * 255.0f + 0.5f); }
+    }
+}
+
+} // namespace
+
+uint32_t mip_count(uint32_t width, uint32_t height)
+{
+    uint32_t result = 1;
+    while (width > 1 || height > 1) {
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+        ++result;
+    }
+    return result;
+}
+
+std::vector<uint8_t> generate_mips(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t channels)
+{
+    std::vector<uint8_t> result;
+    if (width == 0 || height == 0 || (channels != 3 && channels != 4)) { return result; }
+
+    size_t total = 0;
+    for (uint32_t w = width, h = height;; w = std::max(w / 2, 1u), h = std::max(h / 2, 1u)) {
+        total += size_t(w) * h * channels;
+        if (w == 1 && h == 1) { break; }
+    }
+    result.resize(total);
+    std::memcpy(result.data(), pixels, size_t(width) * height * channels);
+
+    // Levels are filtered from the linear values of the previous level, not from its rounded sRGB bytes
+    const auto& t = tables();
+    std::vector<float> src(size_t(width) * height * 4);
+    for (size_t i = 0; i < size_t(width) * height; ++i) {
+        for (uint32_t k = 0; k < 3; ++k) {
+            src[i * 4 + k] = t.to_linear[pixels[i * channels + k]];
+        }
+        src[i * 4 + 3] = channels == 4 ? float(pixels[i * 4 + 3]) / 255.0f : 1.0f;
+    }
+
+    std::vector<float> dst;
+    size_t offset = size_t(width) * height * channels;
+    uint32_t w = width, h = height;
+    while (w > 1 || h > 1) {
+        uint32_t nw = std::max(w / 2, 1u), nh = std::max(h / 2, 1u);
+        dst.resize(size_t(nw) * nh * 4);
+        for (uint32_t y = 0; y < nh; ++y) {
+            auto fy = footprint(y, h);
+            const float* row0 = &src[size_t(fy.first) * w * 4];
+            const float* row1 = row0 + size_t(w) * 4;
+            for (uint32_t x = 0; x < nw; ++x) {
+                auto fx = footprint(x, w);
+                float* out = &dst[(size_t(y) * nw + x) * 4];
+                if (fx.count == 2 && fy.count == 2) {
+                    size_t x0 = size_t(fx.first) * 4, x1 = x0 + 4;
+                    average4(row0 + x0, row0 + x1, row1 + x0, row1 + x1, out);
+                } else {
+                    average(src.data(), w, fx, fy, out);
+                }
+            }
+        }
+        encode(dst, size_t(nw) * nh, channels, result.data() + offset);
+        offset += size_t(nw) * nh * channels;
+        std::swap(src, dst);
+        w = nw;
+        h = nh;
+    }
+
+    return result;
+}
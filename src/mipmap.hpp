@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// Gets the number of levels of a full mip chain down to 1x1
+uint32_t mip_count(uint32_t width, uint32_t height);
+
+/// Builds a full mip chain of an 8 bit RGB or RGBA image with a 2x2 box filter, widened to three texels for the
+/// last row or column of an odd size.  Color is averaged in linear space and stored as sRGB, alpha is averaged as
+/// is.  Returns all levels back to back, the source first.
+std::vector<uint8_t> generate_mips(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t channels);
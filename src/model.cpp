@@ -1,72 +1,508 @@
 #include "model.hpp"
 
 #include "TextureCache.hpp"
+#include "bake.hpp"
+#include "meshopt.hpp"
+#include "packing.hpp"
+#include "skinning.hpp"
 #include "util.hpp"
 
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <type_traits>
+
 extern TextureCache s_textures;
 bgfx::VertexLayout Node::layout;
 bgfx::ProgramHandle Node::skinned_program;
+bgfx::ProgramHandle Node::instanced_program = BGFX_INVALID_HANDLE;
+bgfx::ProgramHandle Node::skinned_instanced_program = BGFX_INVALID_HANDLE;
+
+constexpr uint64_t default_state = 0
+    | BGFX_STATE_WRITE_RGB
+    | BGFX_STATE_WRITE_A
+    | BGFX_STATE_WRITE_Z
+    | BGFX_STATE_DEPTH_TEST_LESS
+    | BGFX_STATE_CULL_CCW
+    | BGFX_STATE_MSAA;
+
+// Adds ``packet`` for all instances, as a single instanced draw when ``instanced_program`` is valid
+static void emit_instances(RenderQueue& queue, RenderPacket packet, bgfx::ProgramHandle instanced_program,
+    std::span<const glm::mat4> instances, const glm::mat4& local)
+{
+    if (packet.state == BGFX_STATE_MASK) { packet.state = default_state; }
+
+    if (instances.size() > 1 && bgfx::isValid(instanced_program)) {
+        packet.program = instanced_program;
+        packet.transform = queue.add_transforms(instances, local);
+        packet.num_instances = uint32_t(instances.size());
+        queue.push(packet);
+        return;
+    }
+
+    for (const auto& mtx : instances) {
+        packet.transform = queue.add_transform(mtx * local);
+        queue.push(packet);
+    }
+}
+
+// Builds levels of detail from ``indices[first, first + count)`` into ``indices``
+template <typename Vertex>
+static std::vector<Lod> build_node_lods(std::vector<uint16_t>& indices, uint32_t first, uint32_t count,
+    std::span<const Vertex> vertices)
+{
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> groups;
+    positions.reserve(vertices.size());
+    for (const auto& v : vertices) {
+        positions.push_back(v.position);
+        if constexpr (std::is_same_v<Vertex, nw::model::SkinVertex>) {
+            // Collapses stay within the region of one dominant bone, so levels deform like full detail
+            int dominant = 0;
+            for (int k = 1; k < 4; ++k) {
+                if (v.weights[k] > v.weights[dominant]) { dominant = k; }
+            }
+            groups.push_back(uint32_t(v.bones[dominant]));
+        }
+    }
+    return build_lods(indices, first, count, positions, groups);
+}
+
+// Optimizes, simplifies and packs the source geometry of a skin into its staged data
+static void stage_skin(Skin* skin, const nw::model::SkinNode* n)
+{
+    // The source keeps its order, other per vertex arrays of the MDL index into it
+    skin->index_data_ = n->indices;
+    auto vertices = n->vertices;
+    auto [before, after] = optimize_mesh(skin->index_data_, vertices);
+    LOG_F(INFO, "name: {} acmr: {:.3f} -> {:.3f}", n->name, before, after);
+
+    if (Model::generate_lods) {
+        skin->lods_ = build_node_lods(skin->index_data_, 0, uint32_t(n->indices.size()),
+            std::span<const nw::model::SkinVertex>(vertices));
+    }
+
+    Aabb aabb{vertices[0].position, vertices[0].position};
+    for (const auto& v : vertices) {
+        aabb.min = glm::min(aabb.min, v.position);
+        aabb.max = glm::max(aabb.max, v.position);
+    }
+    skin->dequant_ = make_dequantize(aabb);
+
+    pack_skin_vertices(vertices, skin->dequant_, Skin::layout, skin->vertex_data_);
+    skin->source_vertices_ = n->vertices;
+    skin->bone_nodes_.clear();
+    for (auto bone : n->bone_nodes) {
+        if (bone < 0) { break; }
+        skin->bone_nodes_.push_back(uint32_t(bone));
+    }
+}
+
+// Optimizes, simplifies and packs the source geometry of a mesh into its staged data
+static void stage_mesh(Mesh* mesh, const nw::model::TrimeshNode* n)
+{
+    // The source keeps its order, other per vertex arrays of the MDL index into it
+    mesh->index_data_ = n->indices;
+    auto vertices = n->vertices;
+    auto [before, after] = optimize_mesh(mesh->index_data_, vertices);
+    LOG_F(INFO, "name: {} index size: {} acmr: {:.3f} -> {:.3f}", n->name, n->indices.size() / 3, before, after);
+
+    if (Model::generate_lods) {
+        mesh->lods_ = build_node_lods(mesh->index_data_, 0, uint32_t(n->indices.size()),
+            std::span<const nw::model::Vertex>(vertices));
+    }
+
+    mesh->aabb_ = {vertices[0].position, vertices[0].position};
+    for (const auto& v : vertices) {
+        mesh->aabb_.min = glm::min(mesh->aabb_.min, v.position);
+        mesh->aabb_.max = glm::max(mesh->aabb_.max, v.position);
+    }
+    mesh->sphere_ = {(mesh->aabb_.min + mesh->aabb_.max) * 0.5f, 0.0f};
+    for (const auto& v : vertices) {
+        mesh->sphere_.radius = std::max(mesh->sphere_.radius, glm::distance(mesh->sphere_.center, v.position));
+    }
+    mesh->dequant_ = make_dequantize(mesh->aabb_);
+
+    pack_vertices(vertices, mesh->dequant_, Node::layout, mesh->vertex_data_);
+    mesh->positions_.clear();
+    mesh->positions_.reserve(vertices.size());
+    for (const auto& v : vertices) {
+        mesh->positions_.push_back(v.position);
+    }
+}
+
+// Stages a skin from data baked by ``stage_skin``, vertices and indices stay in the mapping
+static void stage_baked(Skin* skin, const BakedModel& bake, const BakedNode& baked)
+{
+    skin->baked_vertices_ = bake.array<uint8_t>(baked.vertices_offset, baked.vertices_size);
+    skin->baked_indices_ = bake.array<uint16_t>(baked.indices_offset, baked.num_indices);
+    auto lods = bake.array<Lod>(baked.lods_offset, baked.num_lods);
+    skin->lods_.assign(lods.begin(), lods.end());
+    auto vertices = bake.array<nw::model::SkinVertex>(baked.skin_vertices_offset, baked.num_skin_vertices);
+    skin->source_vertices_.assign(vertices.begin(), vertices.end());
+    auto bones = bake.array<uint32_t>(baked.bones_offset, baked.num_bones);
+    skin->bone_nodes_.assign(bones.begin(), bones.end());
+    skin->bitmap_ = std::string(bake.string(baked.bitmap));
+    skin->dequant_ = baked.dequant;
+}
+
+// Stages a mesh or merged range from data baked by ``stage_mesh`` or ``Model::merge_meshes``.  Meshes baked as
+// merged have nothing staged.
+static void stage_baked(Mesh* mesh, const BakedModel& bake, const BakedNode& baked)
+{
+    mesh->merged_ = baked.flags & baked_merged;
+    if (baked.flags & baked_range) {
+        mesh->range_ = true;
+        mesh->first_vertex_ = baked.first_vertex;
+        mesh->num_vertices_ = baked.num_vertices;
+        mesh->first_index_ = baked.first_index;
+        mesh->num_indices_ = baked.num_range_indices;
+    }
+    mesh->bitmap_ = std::string(bake.string(baked.bitmap));
+    mesh->baked_vertices_ = bake.array<uint8_t>(baked.vertices_offset, baked.vertices_size);
+    mesh->baked_indices_ = bake.array<uint16_t>(baked.indices_offset, baked.num_indices);
+    auto lods = bake.array<Lod>(baked.lods_offset, baked.num_lods);
+    mesh->lods_.assign(lods.begin(), lods.end());
+    auto positions = bake.array<glm::vec3>(baked.positions_offset, baked.num_positions);
+    mesh->positions_.assign(positions.begin(), positions.end());
+    mesh->dequant_ = baked.dequant;
+    mesh->aabb_ = baked.aabb;
+    mesh->sphere_ = baked.sphere;
+}
+
+void init_vertex_layouts(uint32_t attributes)
+{
+    auto caps = bgfx::getCaps();
+    auto texcoord = caps->supported & BGFX_CAPS_VERTEX_ATTRIB_HALF ? bgfx::AttribType::Half : bgfx::AttribType::Float;
+    Node::layout = packed_mesh_layout(attributes, texcoord);
+    Skin::layout = packed_skin_layout(attributes, texcoord);
+}
 
 // == Node ====================================================================
 // ============================================================================
 
-glm::mat4 Node::get_transform() const
+const glm::mat4& Node::get_transform() const
 {
-    auto parent = glm::mat4{1.0f};
-    if (!has_transform_) { return parent; }
-    if (parent_) {
-        parent = parent_->get_transform();
-    }
+    return owner_->worlds_[index_];
+}
+
+glm::mat4 Node::local_transform() const
+{
+    if (!has_transform_) { return glm::mat4{1.0f}; }
 
-    auto trans = glm::translate(parent, position_);
+    auto trans = glm::translate(glm::mat4{1.0f}, position_);
     trans = trans * glm::toMat4(rotation_);
     trans = glm::scale(trans, scale_);
 
     return trans;
 }
 
-void Node::submit(bgfx::ViewId _id, bgfx::ProgramHandle _program, const glm::mat4x4& _mtx, uint64_t _state)
+void Node::set_position(const glm::vec3& position)
 {
-    glm::mat4x4 trans;
-
-    if (has_transform_) {
-        trans = glm::translate(_mtx, position_);
-        trans = trans * glm::toMat4(rotation_);
-        trans = glm::scale(trans, scale_);
-    } else {
-        trans = _mtx;
-    }
+    if (position_ == position) { return; }
+    position_ = position;
+    dirty_ = true;
+    if (owner_) { owner_->transforms_dirty_ = true; }
+}
 
-    for (auto child : children_) {
-        child->submit(_id, _program, trans, _state);
-    }
+void Node::set_rotation(const glm::quat& rotation)
+{
+    if (rotation_ == rotation) { return; }
+    rotation_ = rotation;
+    dirty_ = true;
+    if (owner_) { owner_->transforms_dirty_ = true; }
 }
 
 // == Model ===================================================================
 // ============================================================================
 
-Node* Model::find(std::string_view name)
+bool Model::merge_static_meshes = true;
+bool Model::generate_lods = true;
+
+// Hands staged data to bgfx without a copy, it's freed once bgfx is done with it
+template <typename T>
+static const bgfx::Memory* make_ref(std::vector<T>& data)
 {
-    for (const auto& node : nodes_) {
-        if (nw::string::icmp(node->orig_->name, name)) {
-            return node.get();
+    auto owned = new std::vector<T>(std::move(data));
+    data = {};
+    return bgfx::makeRef(
+        owned->data(), uint32_t(owned->size() * sizeof(T)),
+        [](void*, void* user) { delete static_cast<std::vector<T>*>(user); }, owned);
+}
+
+// Hands baked data to bgfx without a copy, the mapping is kept until bgfx is done with it
+template <typename T>
+static const bgfx::Memory* make_ref(std::span<const T>& data, const std::shared_ptr<MappedFile>& file)
+{
+    auto owned = new std::shared_ptr<MappedFile>(file);
+    auto result = bgfx::makeRef(
+        data.data(), uint32_t(data.size_bytes()),
+        [](void*, void* user) { delete static_cast<std::shared_ptr<MappedFile>*>(user); }, owned);
+    data = {};
+    return result;
+}
+
+Model::~Model()
+{
+    if (bgfx::isValid(joint_palette_)) {
+        bgfx::destroy(joint_palette_);
+    }
+    if (bgfx::isValid(static_vbh_)) {
+        bgfx::destroy(static_vbh_);
+    }
+    if (bgfx::isValid(static_ibh_)) {
+        bgfx::destroy(static_ibh_);
+    }
+}
+
+void Model::build_indices()
+{
+    node_index_.clear();
+    long_node_index_.clear();
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        // First node wins on duplicate names
+        const auto& name = nodes_[i]->name_;
+        if (NameKey key{name}; key.valid()) {
+            node_index_.emplace(key, uint32_t(i));
+        } else {
+            long_node_index_.emplace(nw::string::tolower(name), uint32_t(i));
+        }
+    }
+
+    // Animations on a model override those of the same name on its supermodels
+    animation_index_.clear();
+    auto add_animations = [this](const AnimationSet* set) {
+        if (!set) { return; }
+        for (const auto& anim : set->animations) {
+            animation_index_.emplace(nw::string::tolower(anim.name), &anim);
         }
+    };
+    add_animations(animations_.get());
+    for (auto set : supermodels_) {
+        add_animations(set);
+    }
+}
+
+uint32_t Model::find_index(std::string_view name) const
+{
+    if (NameKey key{name}; key.valid()) {
+        auto it = node_index_.find(key);
+        return it == std::end(node_index_) ? UINT32_MAX : it->second;
     }
+    auto it = long_node_index_.find(nw::string::tolower(name));
+    return it == std::end(long_node_index_) ? UINT32_MAX : it->second;
+}
 
-    return nullptr;
+Node* Model::find(std::string_view name)
+{
+    auto idx = find_index(name);
+    if (idx == UINT32_MAX) { return nullptr; }
+    return nodes_[idx].get();
 }
 
 void Model::initialize_skins()
 {
+    uint32_t rows = 0;
     for (auto& node : nodes_) {
-        if (node->orig_->type == nw::model::NodeType::skin) {
-            auto n = static_cast<Skin*>(node.get());
+        if (auto n = dynamic_cast<Skin*>(node.get())) {
             n->build_inverse_binds();
+
+            n->num_bones_ = 0;
+            while (n->num_bones_ < n->bone_nodes_.size() && n->bone_nodes_[n->num_bones_] < nodes_.size()) {
+                ++n->num_bones_;
+            }
+            if (n->num_bones_ > max_uniform_joints && !bgfx::isValid(Skin::palette_program)) {
+                LOG_F(WARNING, "Skin {} has {} bones, only {} are supported without a palette texture", n->name_,
+                    n->num_bones_, max_uniform_joints);
+            }
+            n->palette_offset_ = rows;
+            rows += n->num_bones_;
+
+            // Inverse binds are rigid, so distances to bones are preserved by any pose
+            n->bone_radii_.assign(n->num_bones_, 0.0f);
+            for (const auto& v : n->source_vertices_) {
+                for (int k = 0; k < 4; ++k) {
+                    if (v.weights[k] == 0.0f || v.bones[k] < 0 || uint32_t(v.bones[k]) >= n->num_bones_) { continue; }
+                    auto p = n->inverse_bind_pose_[n->bone_nodes_[v.bones[k]]] * glm::vec4{v.position, 1.0f};
+                    n->bone_radii_[v.bones[k]] = std::max(n->bone_radii_[v.bones[k]], glm::length(glm::vec3{p.x, p.y, p.z}));
+                }
+            }
         }
     }
+
+    palette_.resize(rows, glm::mat4{1.0f});
+    palette_version_ = 0;
+}
+
+void Model::update_joint_palette()
+{
+    if (palette_.empty() || palette_version_ == transform_version_) { return; }
+
+    for (auto& node : nodes_) {
+        auto n = dynamic_cast<Skin*>(node.get());
+        if (!n) { continue; }
+        for (uint32_t i = 0; i < n->num_bones_; ++i) {
+            auto bone = n->bone_nodes_[i];
+            palette_[n->palette_offset_ + i] = worlds_[bone] * n->inverse_bind_pose_[bone];
+        }
+    }
+
+    if (bgfx::isValid(joint_palette_)) {
+        auto mem = bgfx::copy(palette_.data(), uint32_t(palette_.size() * sizeof(glm::mat4)));
+        bgfx::updateTexture2D(joint_palette_, 0, 0, 0, 0, 4, uint16_t(palette_.size()), mem);
+    }
+    palette_version_ = transform_version_;
+}
+
+void Model::merge_meshes()
+{
+    // Any node with position or orientation keys in any animation moves, and so does its subtree
+    std::vector<uint8_t> animated(nodes_.size(), 0);
+    for (const auto& [name, anim] : animation_index_) {
+        for (const auto& node : anim->nodes) {
+            auto idx = find_index(node.name);
+            if (idx != UINT32_MAX) { animated[idx] = 1; }
+        }
+    }
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        if (parents_[i] >= 0 && animated[parents_[i]]) { animated[i] = 1; }
+    }
+
+    // Vertices are in model space, so ranges are unparented nodes with an identity transform
+    auto append_range = [this](std::unique_ptr<Mesh> mesh) {
+        mesh->owner_ = this;
+        mesh->index_ = uint32_t(nodes_.size());
+        mesh->dirty_ = false;
+        nodes_.push_back(std::move(mesh));
+        parents_.push_back(-1);
+        locals_.push_back(glm::mat4{1.0f});
+        worlds_.push_back(glm::mat4{1.0f});
+        world_changed_.push_back(0);
+    };
+
+    // Group static meshes by texture, keeping load order within a group
+    absl::flat_hash_map<std::string, std::vector<Mesh*>> groups;
+    std::vector<std::string> textures;
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        if (animated[i] || nodes_[i]->no_render_ || !nodes_[i]->orig_) { continue; }
+        if (nodes_[i]->orig_->type & nw::model::NodeFlags::skin) { continue; }
+        auto mesh = dynamic_cast<Mesh*>(nodes_[i].get());
+        if (!mesh) { continue; }
+        auto bitmap = nw::string::tolower(mesh->bitmap_);
+        auto& group = groups[bitmap];
+        if (group.empty()) { textures.push_back(bitmap); }
+        group.push_back(mesh);
+    }
+
+    size_t mergeable = 0;
+    for (const auto& [tex, group] : groups) {
+        mergeable += group.size();
+    }
+    if (mergeable < 2) { return; }
+
+    // All groups share one vertex and index buffer.  Indices are 16 bit and relative to the first vertex of
+    // their range, so a range is split whenever it would exceed 65536 vertices.
+    std::vector<nw::model::Vertex> vertices;
+    std::vector<uint16_t> indices;
+    std::vector<std::unique_ptr<Mesh>> merged;
+
+    auto start_range = [&](const std::string& bitmap) {
+        auto mesh = std::make_unique<Mesh>();
+        mesh->range_ = true;
+        mesh->bitmap_ = bitmap;
+        mesh->first_vertex_ = uint32_t(vertices.size());
+        mesh->first_index_ = uint32_t(indices.size());
+        merged.push_back(std::move(mesh));
+        return merged.back().get();
+    };
+
+    for (const auto& tex : textures) {
+        Mesh* range = nullptr;
+        for (auto mesh : groups[tex]) {
+            auto orig = static_cast<nw::model::TrimeshNode*>(mesh->orig_);
+            if (!range || vertices.size() - range->first_vertex_ + orig->vertices.size() > 65536) {
+                range = start_range(mesh->bitmap_);
+            }
+
+            const auto& trans = mesh->get_transform();
+            auto normal_trans = glm::mat3{glm::transpose(glm::inverse(trans))};
+            auto base = uint16_t(vertices.size() - range->first_vertex_);
+            for (auto v : orig->vertices) {
+                v.position = glm::vec3{trans * glm::vec4{v.position, 1.0f}};
+                v.normal = glm::normalize(normal_trans * v.normal);
+                auto tangent = glm::normalize(glm::mat3{trans} * glm::vec3{v.tangent});
+                v.tangent = glm::vec4{tangent, v.tangent.w};
+                vertices.push_back(v);
+            }
+            for (auto idx : orig->indices) {
+                indices.push_back(uint16_t(base + idx));
+            }
+
+            mesh->merged_ = true;
+            mesh->vertex_data_ = {};
+            mesh->index_data_ = {};
+        }
+    }
+
+    // Each range is optimized as a whole, since sources are in file order, and quantized over its own bounds
+    auto& packed = static_vertex_data_;
+    for (size_t i = 0; i < merged.size(); ++i) {
+        auto mesh = merged[i].get();
+        uint32_t vertex_end = i + 1 < merged.size() ? merged[i + 1]->first_vertex_ : uint32_t(vertices.size());
+        uint32_t index_end = i + 1 < merged.size() ? merged[i + 1]->first_index_ : uint32_t(indices.size());
+        mesh->num_vertices_ = vertex_end - mesh->first_vertex_;
+        mesh->num_indices_ = index_end - mesh->first_index_;
+
+        std::vector<uint16_t> range_indices(indices.begin() + mesh->first_index_, indices.begin() + index_end);
+        std::vector<nw::model::Vertex> range_vertices(vertices.begin() + mesh->first_vertex_,
+            vertices.begin() + vertex_end);
+        optimize_mesh(range_indices, range_vertices);
+        std::copy(range_indices.begin(), range_indices.end(), indices.begin() + mesh->first_index_);
+        std::copy(range_vertices.begin(), range_vertices.end(), vertices.begin() + mesh->first_vertex_);
+
+        mesh->aabb_ = {vertices[mesh->first_vertex_].position, vertices[mesh->first_vertex_].position};
+        for (uint32_t j = mesh->first_vertex_; j < vertex_end; ++j) {
+            mesh->aabb_.min = glm::min(mesh->aabb_.min, vertices[j].position);
+            mesh->aabb_.max = glm::max(mesh->aabb_.max, vertices[j].position);
+        }
+        mesh->sphere_ = {(mesh->aabb_.min + mesh->aabb_.max) * 0.5f, 0.0f};
+        for (uint32_t j = mesh->first_vertex_; j < vertex_end; ++j) {
+            mesh->sphere_.radius = std::max(mesh->sphere_.radius, glm::distance(mesh->sphere_.center, vertices[j].position));
+        }
+        mesh->dequant_ = make_dequantize(mesh->aabb_);
+        pack_vertices(std::span<const nw::model::Vertex>(&vertices[mesh->first_vertex_], mesh->num_vertices_),
+            mesh->dequant_, Node::layout, packed);
+    }
+
+    if (generate_lods) {
+        for (auto& mesh : merged) {
+            mesh->lods_ = build_node_lods(indices, mesh->first_index_, mesh->num_indices_,
+                std::span<const nw::model::Vertex>(&vertices[mesh->first_vertex_], mesh->num_vertices_));
+        }
+    }
+
+    static_index_data_ = std::move(indices);
+
+    for (auto& range : merged) {
+        append_range(std::move(range));
+    }
+
+    LOG_F(INFO, "Merged {} static meshes into {} draws", mergeable, merged.size());
+}
+
+void Model::initialize_nodes()
+{
+    parents_.resize(nodes_.size());
+    for (auto& node : nodes_) {
+        node->owner_ = this;
+        parents_[node->index_] = node->parent_ ? int32_t(node->parent_->index_) : -1;
+    }
+    locals_.resize(nodes_.size());
+    worlds_.resize(nodes_.size());
+    world_changed_.resize(nodes_.size());
+    update_transforms();
+    build_indices();
+    initialize_skins();
 }
 
 bool Model::load(nw::model::Model* mdl)
@@ -76,35 +512,137 @@ bool Model::load(nw::model::Model* mdl)
         LOG_F(INFO, "No root dummy");
         return false;
     }
-    if (load_node(root)) {
-        mdl_ = mdl;
-        for (auto& node : nodes_) {
-            node->owner_ = this;
+    if (!load_node(root)) { return false; }
+
+    animations_ = compile_animations(*mdl);
+    initialize_nodes();
+    if (merge_static_meshes) { merge_meshes(); }
+
+    // Everything kept was copied out of the source
+    for (auto& node : nodes_) {
+        node->orig_ = nullptr;
+    }
+    return true;
+}
+
+bool Model::load(const BakedModel& bake)
+{
+    for (size_t i = 0; i < bake.nodes_.size(); ++i) {
+        const auto& baked = bake.nodes_[i];
+        Node* result = nullptr;
+        if (baked.flags & baked_skin) {
+            auto skin = new Skin;
+            stage_baked(skin, bake, baked);
+            result = skin;
+        } else if (baked.flags & baked_mesh) {
+            auto mesh = new Mesh;
+            stage_baked(mesh, bake, baked);
+            result = mesh;
+        } else {
+            result = new Node;
+        }
+        result->name_ = std::string(bake.string(baked.name));
+        result->has_transform_ = baked.flags & baked_transform;
+        result->no_render_ = baked.flags & baked_no_render;
+        result->position_ = baked.position;
+        result->rotation_ = baked.rotation;
+        result->index_ = uint32_t(i);
+
+        // Parents precede their children, see ``BakedModel::open``
+        if (baked.parent >= 0) {
+            result->parent_ = nodes_[baked.parent].get();
+            result->parent_->children_.push_back(result);
         }
-        initialize_skins();
-        return true;
+        nodes_.emplace_back(result);
     }
-    return false;
+    if (nodes_.empty()) { return false; }
+
+    const auto& header = *bake.header_;
+    baked_static_vertices_ = bake.array<uint8_t>(header.static_vertices_offset, header.static_vertices_size);
+    baked_static_indices_ = bake.array<uint16_t>(header.static_indices_offset, header.num_static_indices);
+    bake_file_ = bake.file_;
+    animations_ = bake.animations();
+    initialize_nodes();
+    return true;
 }
 
-bool Model::load_animation(std::string_view anim)
+bool Model::upload(std::chrono::steady_clock::time_point deadline)
 {
-    anim_ = nullptr;
-    nw::model::Model* m = mdl_;
-    while (m) {
-        for (const auto& it : m->animations) {
-            if (it->name == anim) {
-                anim_ = it.get();
-                break;
-            }
+    if (upload_cursor_ == 0) {
+        gpu_bytes_ = staged_bytes();
+        if (baked_static_vertices_.size()) {
+            static_vbh_ = bgfx::createVertexBuffer(make_ref(baked_static_vertices_, bake_file_), Node::layout);
+            static_ibh_ = bgfx::createIndexBuffer(make_ref(baked_static_indices_, bake_file_));
+        } else if (static_vertex_data_.size()) {
+            static_vbh_ = bgfx::createVertexBuffer(make_ref(static_vertex_data_), Node::layout);
+            static_ibh_ = bgfx::createIndexBuffer(make_ref(static_index_data_));
+        }
+        if (palette_.size() && bgfx::isValid(Skin::palette_program)) {
+            joint_palette_ = bgfx::createTexture2D(4, uint16_t(palette_.size()), false, 1,
+                bgfx::TextureFormat::RGBA32F, BGFX_SAMPLER_POINT | BGFX_SAMPLER_UVW_CLAMP);
+            palette_version_ = transform_version_ - 1;
         }
-        if (!m->supermodel || anim_) { break; }
-        m = &m->supermodel->model;
     }
-    if (anim_) {
-        LOG_F(INFO, "Loaded animation: {} from model: {}", anim, m->name);
+
+    while (upload_cursor_ < nodes_.size()) {
+        nodes_[upload_cursor_++]->upload();
+        if (std::chrono::steady_clock::now() >= deadline) { break; }
     }
-    return !!anim_;
+    if (upload_cursor_ < nodes_.size()) { return false; }
+
+    // Buffers created from the bake hold their own reference to the mapping
+    bake_file_.reset();
+    return true;
+}
+
+size_t Model::source_bytes() const
+{
+    size_t result = animations_ ? animations_->keys.capacity() * sizeof(float) : 0;
+    for (const auto& node : nodes_) {
+        if (auto skin = dynamic_cast<const Skin*>(node.get())) {
+            result += skin->source_vertices_.capacity() * sizeof(nw::model::SkinVertex);
+        } else if (auto mesh = dynamic_cast<const Mesh*>(node.get())) {
+            result += mesh->positions_.capacity() * sizeof(glm::vec3);
+        }
+    }
+    return result;
+}
+
+size_t Model::staged_bytes() const
+{
+    size_t result = staged_static_vertices().size() + staged_static_indices().size() * sizeof(uint16_t);
+    for (const auto& node : nodes_) {
+        result += node->staged_bytes();
+    }
+    return result;
+}
+
+bool Model::load_animation(std::string_view anim)
+{
+    anim_ = nullptr;
+    anim_bindings_.clear();
+
+    auto it = animation_index_.find(nw::string::tolower(anim));
+    if (it == std::end(animation_index_)) { return false; }
+    anim_ = it->second;
+
+    // Compiled animations only hold nodes with keys
+    for (const auto& node : anim_->nodes) {
+        auto idx = find_index(node.name);
+        if (idx == UINT32_MAX) { continue; }
+
+        AnimationBinding binding;
+        binding.node = idx;
+        binding.position.time = node.position.time;
+        binding.position.data = node.position.data;
+        binding.orientation.time = node.orientation.time;
+        binding.orientation.data = node.orientation.data;
+        anim_bindings_.push_back(binding);
+    }
+
+    LOG_F(INFO, "Loaded animation: {}, bound tracks: {}", anim, anim_bindings_.size());
+    anim_cursor_ = 0;
+    return true;
 }
 
 Node* Model::load_node(nw::model::Node* node, Node* parent)
@@ -114,19 +652,8 @@ Node* Model::load_node(nw::model::Node* node, Node* parent)
         auto n = static_cast<nw::model::SkinNode*>(node);
         if (!n->indices.empty()) {
             Skin* skin = new Skin;
-            auto index_mem = bgfx::makeRef(n->indices.data(), uint32_t(n->indices.size() * sizeof(uint16_t)));
-            skin->ibh_ = bgfx::createIndexBuffer(index_mem);
-
-            auto mem = bgfx::makeRef(n->vertices.data(), uint32_t(n->vertices.size() * Skin::layout.getStride()));
-            skin->vbh_ = bgfx::createVertexBuffer(mem, Skin::layout);
-
-            auto tex = s_textures.load(n->bitmap);
-            if (tex) {
-                skin->texture0 = *tex;
-            } else {
-                LOG_F(FATAL, "Failed to bind texture");
-            }
-
+            stage_skin(skin, n);
+            skin->bitmap_ = n->bitmap;
             result = skin;
         } else {
             LOG_F(ERROR, "No vertex indicies");
@@ -136,20 +663,8 @@ Node* Model::load_node(nw::model::Node* node, Node* parent)
         if (!n->indices.empty()) {
             Mesh* mesh = new Mesh;
             mesh->no_render_ = !n->render;
-            LOG_F(INFO, "name: {} index size: {}", n->name, n->indices.size() / 3);
-
-            auto index_mem = bgfx::makeRef(n->indices.data(), uint32_t(n->indices.size() * sizeof(uint16_t)));
-            mesh->ibh_ = bgfx::createIndexBuffer(index_mem);
-
-            auto mem = bgfx::makeRef(n->vertices.data(), uint32_t(n->vertices.size() * Node::layout.getStride()));
-            mesh->vbh_ = bgfx::createVertexBuffer(mem, Node::layout);
-
-            auto tex = s_textures.load(n->bitmap);
-            if (tex) {
-                mesh->texture0 = *tex;
-            } else {
-                LOG_F(FATAL, "Failed to bind texture");
-            }
+            stage_mesh(mesh, n);
+            mesh->bitmap_ = n->bitmap;
             result = mesh;
 
         } else {
@@ -160,6 +675,7 @@ Node* Model::load_node(nw::model::Node* node, Node* parent)
     }
     result->parent_ = parent;
     result->orig_ = node;
+    result->name_ = node->name;
 
     auto key = node->get_controller(nw::model::ControllerType::Position);
     if (key.data.size()) {
@@ -176,6 +692,7 @@ Node* Model::load_node(nw::model::Node* node, Node* parent)
         result->rotation_ = glm::qua{key.data[3], key.data[0], key.data[1], key.data[2]};
     }
 
+    result->index_ = uint32_t(nodes_.size());
     nodes_.emplace_back(result);
     for (auto child : node->children) {
         result->children_.push_back(load_node(child, result));
@@ -194,159 +711,367 @@ void Model::update(int32_t dt)
         anim_cursor_ += dt;
     }
 
-    for (const auto& anim : anim_->nodes) {
-        // LOG_F(INFO, "animation node: {}, cursor: {}", anim->name, anim_cursor_);
-        auto node = find(anim->name);
-        if (node) {
-            auto poskey = anim->get_controller(nw::model::ControllerType::Position, true);
-            // LOG_F(INFO, "time size: {}, data size: {}", poskey.time.size(), poskey.data.size());
-            if (poskey.time.size()) {
-                int i = 0;
-                int start = 0, end = 0;
-                while (i < poskey.time.size() && anim_cursor_ >= int32_t(poskey.time[i] * 1000)) {
-                    ++i;
-                }
-                end = i;
-                if (end >= poskey.time.size()) { end = 0; }
-                // start = i - 1;
-                // if (start < 0) { start = poskey.time.size() - 1; }
-                node->position_ = glm::vec3{poskey.data[end * 3], poskey.data[end * 3 + 1], poskey.data[end * 3 + 2]};
+    const float time = float(anim_cursor_) / 1000.0f;
+    for (auto& binding : anim_bindings_) {
+        auto node = nodes_[binding.node].get();
+        if (binding.position.time.size()) {
+            node->set_position(sample_position(binding.position, time));
+        }
+        if (binding.orientation.time.size()) {
+            node->set_rotation(sample_orientation(binding.orientation, time));
+        }
+    }
+
+    update_transforms();
+}
+
+bool Model::posed_bounds(glm::vec3& min, glm::vec3& max, WorkerPool* pool)
+{
+    update_joint_palette();
+
+    bool found = false;
+    auto expand = [&](const glm::vec3& p) {
+        min = found ? glm::min(min, p) : p;
+        max = found ? glm::max(max, p) : p;
+        found = true;
+    };
+
+    std::vector<glm::vec3> positions, normals;
+    for (const auto& node : nodes_) {
+        if (node->no_render_) { continue; }
+
+        if (auto skin = dynamic_cast<Skin*>(node.get())) {
+            skin->pose(positions, normals, pool);
+            for (const auto& p : positions) {
+                expand(p);
+            }
+        } else if (auto mesh = dynamic_cast<Mesh*>(node.get()); mesh && !mesh->range_) {
+            // Merged ranges duplicate the geometry of their source meshes
+            const auto& trans = node->get_transform();
+            for (const auto& v : mesh->positions_) {
+                auto p = trans * glm::vec4{v, 1.0f};
+                expand(glm::vec3{p.x, p.y, p.z});
+            }
+        }
+    }
+
+    return found;
+}
+
+void Model::submit(RenderQueue& _queue, bgfx::ViewId _id, bgfx::ProgramHandle _program,
+    std::span<const glm::mat4> _instances, uint64_t _state, const Frustum* _frustum, CullStats* _stats,
+    const LodSelector* _lod)
+{
+    update_joint_palette();
+
+    for (auto& node : nodes_) {
+        Sphere sphere;
+        if (!node->bounds(sphere)) { continue; }
+
+        auto instances = _instances;
+        if (_frustum) {
+            cull_spheres_.resize(_instances.size());
+            cull_flags_.resize(_instances.size());
+            for (size_t i = 0; i < _instances.size(); ++i) {
+                cull_spheres_[i] = transform_sphere(sphere, _instances[i]);
             }
 
-            auto orikey = anim->get_controller(nw::model::ControllerType::Orientation, true);
-            if (orikey.time.size()) {
-                int i = 0;
-                int start = 0, end = 0;
-                while (i < orikey.time.size() && anim_cursor_ >= int32_t(orikey.time[i] * 1000)) {
-                    ++i;
+            size_t visible = cull_spheres(*_frustum, cull_spheres_, cull_flags_);
+            if (_stats) {
+                _stats->visible += uint32_t(visible);
+                _stats->culled += uint32_t(_instances.size() - visible);
+            }
+            if (visible == 0) { continue; }
+
+            if (visible < _instances.size()) {
+                visible_instances_.clear();
+                for (size_t i = 0; i < _instances.size(); ++i) {
+                    if (cull_flags_[i]) { visible_instances_.push_back(_instances[i]); }
                 }
-                end = i;
-                if (end >= orikey.time.size()) { end = 0; }
-                // start = i - 1;
-                // if (start < 0) { start = poskey.time.size() - 1; }
-                node->rotation_ = glm::qua{
-                    orikey.data[end * 4 + 3],
-                    orikey.data[end * 4],
-                    orikey.data[end * 4 + 1],
-                    orikey.data[end * 4 + 2],
-                };
+                instances = visible_instances_;
+            }
+        }
+
+        auto lods = node->lods();
+        if (!_lod || lods.empty()) {
+            node->emit(_queue, _id, _program, instances, _state, 0);
+            continue;
+        }
+
+        lod_instances_.resize(lods.size() + 1);
+        for (auto& bucket : lod_instances_) {
+            bucket.clear();
+        }
+        for (const auto& mtx : instances) {
+            auto world = transform_sphere(sphere, mtx);
+            float scale = sphere.radius > 0.0f ? world.radius / sphere.radius : 1.0f;
+            lod_instances_[_lod->select(lods, world.center, world.radius, scale)].push_back(mtx);
+        }
+        for (uint32_t level = 0; level <= lods.size(); ++level) {
+            if (lod_instances_[level].size()) {
+                node->emit(_queue, _id, _program, lod_instances_[level], _state, level);
             }
         }
     }
 }
 
-void Model::submit(bgfx::ViewId _id, bgfx::ProgramHandle _program, const glm::mat4& _mtx, uint64_t _state)
+void Model::update_transforms()
 {
-    nodes_[0]->submit(_id, _program, _mtx, _state);
+    if (!transforms_dirty_) { return; }
+
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        auto node = nodes_[i].get();
+        bool parent_changed = parents_[i] >= 0 && world_changed_[parents_[i]];
+        world_changed_[i] = node->dirty_ || parent_changed;
+        if (!world_changed_[i]) { continue; }
+
+        if (node->dirty_) {
+            locals_[i] = node->local_transform();
+            node->dirty_ = false;
+        }
+        worlds_[i] = parents_[i] < 0 ? locals_[i] : worlds_[parents_[i]] * locals_[i];
+    }
+
+    transforms_dirty_ = false;
+    ++transform_version_;
+}
+
+std::unique_ptr<AnimationSet> compile_animations(const nw::model::Model& mdl)
+{
+    auto result = std::make_unique<AnimationSet>();
+
+    // Tracks point into ``keys``, so it's sized up front and never reallocates
+    size_t num_keys = 0;
+    for (const auto& anim : mdl.animations) {
+        for (const auto& node : anim->nodes) {
+            for (auto type : {nw::model::ControllerType::Position, nw::model::ControllerType::Orientation}) {
+                auto key = node->get_controller(type, true);
+                num_keys += key.time.size() + key.data.size();
+            }
+        }
+    }
+    result->keys.reserve(num_keys);
+
+    auto& keys = result->keys;
+    auto copy = [&keys](const nw::model::ControllerKey& key) {
+        AnimationTrack track;
+        size_t time = keys.size();
+        keys.insert(keys.end(), key.time.begin(), key.time.end());
+        size_t data = keys.size();
+        keys.insert(keys.end(), key.data.begin(), key.data.end());
+        track.time = std::span<const float>(keys).subspan(time, key.time.size());
+        track.data = std::span<const float>(keys).subspan(data, key.data.size());
+        return track;
+    };
+
+    for (const auto& anim : mdl.animations) {
+        Animation compiled;
+        compiled.name = anim->name;
+        compiled.length = anim->length;
+        for (const auto& node : anim->nodes) {
+            auto position = node->get_controller(nw::model::ControllerType::Position, true);
+            auto orientation = node->get_controller(nw::model::ControllerType::Orientation, true);
+            if (position.time.empty() && orientation.time.empty()) { continue; }
+            compiled.nodes.push_back({node->name, copy(position), copy(orientation)});
+        }
+        result->animations.push_back(std::move(compiled));
+    }
+    return result;
 }
 
 // == Mesh ===================================================================
 // ============================================================================
 
-void Mesh::submit(bgfx::ViewId _id, bgfx::ProgramHandle _program, const glm::mat4& _mtx, uint64_t _state)
+void Mesh::emit(RenderQueue& _queue, bgfx::ViewId _id, bgfx::ProgramHandle _program,
+    std::span<const glm::mat4> _instances, uint64_t _state, uint32_t _lod)
 {
-    static bgfx::UniformHandle s_texColor = bgfx::createUniform("s_texColor", bgfx::UniformType::Sampler);
+    if (no_render_ || merged_) { return; }
 
-    auto trans = glm::translate(_mtx, position_);
-    trans = trans * glm::toMat4(rotation_);
-    trans = glm::scale(trans, scale_);
+    RenderPacket packet;
+    packet.view = _id;
+    packet.program = _program;
+    packet.texture = texture0 ? texture0->handle_ : s_textures.place_holder_;
+    packet.vbh = vbh_;
+    packet.ibh = ibh_;
+    if (num_indices_) {
+        packet.first_vertex = first_vertex_;
+        packet.num_vertices = num_vertices_;
+        packet.first_index = first_index_;
+        packet.num_indices = num_indices_;
+    }
+    if (_lod > 0 && _lod <= lods_.size()) {
+        packet.first_index = lods_[_lod - 1].first_index;
+        packet.num_indices = lods_[_lod - 1].num_indices;
+    }
+    packet.state = _state;
+    emit_instances(_queue, packet, Node::instanced_program, _instances, get_transform() * dequant_.matrix());
+}
 
-    if (!no_render_) {
-        if (BGFX_STATE_MASK == _state) {
-            _state = 0
-                | BGFX_STATE_WRITE_RGB
-                | BGFX_STATE_WRITE_A
-                | BGFX_STATE_WRITE_Z
-                | BGFX_STATE_DEPTH_TEST_LESS
-                | BGFX_STATE_CULL_CCW
-                | BGFX_STATE_MSAA;
-        }
+Mesh::~Mesh()
+{
+    // Merged ranges draw from the model's buffers
+    if (!range_ && bgfx::isValid(vbh_)) { bgfx::destroy(vbh_); }
+    if (!range_ && bgfx::isValid(ibh_)) { bgfx::destroy(ibh_); }
+    s_textures.release(texture0);
+}
 
-        bgfx::setTransform(&trans[0][0]);
-        bgfx::setState(_state);
-        bgfx::setVertexBuffer(0, vbh_);
-        bgfx::setIndexBuffer(ibh_);
-        bgfx::setTexture(0, s_texColor, texture0);
-        bgfx::submit(
-            _id, _program, 0, BGFX_DISCARD_INDEX_BUFFER | BGFX_DISCARD_VERTEX_STREAMS);
+void Mesh::upload()
+{
+    if (merged_) { return; }
 
-        bgfx::discard();
-    }
-    for (auto child : children_) {
-        child->submit(_id, _program, trans, _state);
+    if (range_) {
+        vbh_ = owner_->static_vbh_;
+        ibh_ = owner_->static_ibh_;
+    } else if (baked_vertices_.size()) {
+        vbh_ = bgfx::createVertexBuffer(make_ref(baked_vertices_, owner_->bake_file_), Node::layout);
+        ibh_ = bgfx::createIndexBuffer(make_ref(baked_indices_, owner_->bake_file_));
+    } else if (vertex_data_.size()) {
+        vbh_ = bgfx::createVertexBuffer(make_ref(vertex_data_), Node::layout);
+        ibh_ = bgfx::createIndexBuffer(make_ref(index_data_));
     }
+    texture0 = s_textures.acquire(bitmap_);
+}
+
+bool Mesh::bounds(Sphere& result) const
+{
+    if (no_render_ || merged_) { return false; }
+    result = transform_sphere(sphere_, get_transform());
+    return true;
 }
 
 // == Skin ====================================================================
 // ============================================================================
 
 bgfx::VertexLayout Skin::layout;
+bgfx::ProgramHandle Skin::palette_program = BGFX_INVALID_HANDLE;
+bgfx::ProgramHandle Skin::palette_instanced_program = BGFX_INVALID_HANDLE;
 
-void Skin::submit(bgfx::ViewId _id, bgfx::ProgramHandle _program, const glm::mat4& _mtx, uint64_t _state)
+Skin::~Skin()
 {
-    static bgfx::UniformHandle s_texColor = bgfx::createUniform("s_texColor", bgfx::UniformType::Sampler);
-    static bgfx::UniformHandle u_joints = bgfx::createUniform("u_joints", bgfx::UniformType::Mat4, 64);
+    if (bgfx::isValid(vbh_)) { bgfx::destroy(vbh_); }
+    if (bgfx::isValid(ibh_)) { bgfx::destroy(ibh_); }
+    s_textures.release(texture0);
+}
 
-    if (BGFX_STATE_MASK == _state) {
-        _state = 0
-            | BGFX_STATE_WRITE_RGB
-            | BGFX_STATE_WRITE_A
-            | BGFX_STATE_WRITE_Z
-            | BGFX_STATE_DEPTH_TEST_LESS
-            | BGFX_STATE_CULL_CCW
-            | BGFX_STATE_MSAA;
+void Skin::upload()
+{
+    if (baked_vertices_.size()) {
+        vbh_ = bgfx::createVertexBuffer(make_ref(baked_vertices_, owner_->bake_file_), Skin::layout);
+        ibh_ = bgfx::createIndexBuffer(make_ref(baked_indices_, owner_->bake_file_));
+    } else if (vertex_data_.size()) {
+        vbh_ = bgfx::createVertexBuffer(make_ref(vertex_data_), Skin::layout);
+        ibh_ = bgfx::createIndexBuffer(make_ref(index_data_));
     }
+    texture0 = s_textures.acquire(bitmap_);
+}
 
-    auto orig = static_cast<nw::model::SkinNode*>(orig_);
+SkinBinding Skin::joint_binding() const
+{
+    SkinBinding result;
+    result.palette = owner_->joint_palette_;
+    result.params = glm::vec4{float(palette_offset_), 1.0f / float(std::max(owner_->palette_.size(), size_t(1))), 0.0f, 0.0f};
+    result.joints = num_bones_ ? &owner_->palette_[palette_offset_] : nullptr;
+    result.num_joints = uint16_t(num_bones_);
+    result.dequant[0] = glm::vec4{dequant_.offset, 0.0f};
+    result.dequant[1] = glm::vec4{dequant_.scale, 0.0f};
+    return result;
+}
 
-    for (size_t i = 0; i < 64; ++i) {
-        if (orig->bone_nodes[i] < 0 || size_t(orig->bone_nodes[i]) >= owner_->nodes_.size()) {
-            break;
-        }
-        auto bone_node = owner_->nodes_[orig->bone_nodes[i]].get();
-        joints_[i] = bone_node->get_transform() * inverse_bind_pose_[orig->bone_nodes[i]];
+void Skin::emit(RenderQueue& _queue, bgfx::ViewId _id, bgfx::ProgramHandle _program,
+    std::span<const glm::mat4> _instances, uint64_t _state, uint32_t _lod)
+{
+    auto binding = joint_binding();
+    bool palette = bgfx::isValid(binding.palette);
+
+    RenderPacket packet;
+    packet.view = _id;
+    packet.program = palette ? Skin::palette_program : Node::skinned_program;
+    packet.texture = texture0 ? texture0->handle_ : s_textures.place_holder_;
+    packet.vbh = vbh_;
+    packet.ibh = ibh_;
+    packet.state = _state;
+    packet.skin = _queue.add_skin(binding);
+    if (_lod > 0 && _lod <= lods_.size()) {
+        packet.first_index = lods_[_lod - 1].first_index;
+        packet.num_indices = lods_[_lod - 1].num_indices;
     }
 
-    bgfx::setTransform(&_mtx[0][0]);
-    bgfx::setState(_state);
-    bgfx::setVertexBuffer(0, vbh_);
-    bgfx::setIndexBuffer(ibh_);
-    bgfx::setTexture(0, s_texColor, texture0);
-    bgfx::setUniform(u_joints, joints_.data(), UINT16_MAX);
-    bgfx::submit(
-        _id, Node::skinned_program, 0, BGFX_DISCARD_INDEX_BUFFER | BGFX_DISCARD_VERTEX_STREAMS);
+    // Joints are in model space, relative to the skin's bind pose
+    auto local = parent_ ? parent_->get_transform() : glm::mat4{1.0f};
+    emit_instances(_queue, packet, palette ? Skin::palette_instanced_program : Node::skinned_instanced_program,
+        _instances, local);
+}
 
-    bgfx::discard();
+bool Skin::bounds(Sphere& result) const
+{
+    // Skinned vertices are a weighted average of points within ``bone_radii_`` of their bones, so the
+    // box around all bone spheres contains the posed mesh.
+    auto base = parent_ ? parent_->get_transform() : glm::mat4{1.0f};
 
-    for (auto child : children_) {
-        child->submit(_id, _program, _mtx, _state);
+    Aabb aabb;
+    bool found = false;
+    for (uint32_t i = 0; i < num_bones_; ++i) {
+        if (bone_radii_[i] <= 0.0f) { continue; }
+        auto c = base * owner_->worlds_[bone_nodes_[i]][3];
+        glm::vec3 center{c.x, c.y, c.z};
+        glm::vec3 extent{bone_radii_[i]};
+        aabb.min = found ? glm::min(aabb.min, center - extent) : center - extent;
+        aabb.max = found ? glm::max(aabb.max, center + extent) : center + extent;
+        found = true;
     }
+
+    if (found) { result = to_sphere(aabb); }
+    return found;
 }
 
-inline void build_inverse_bind_array(Skin* parent, Node* node, glm::mat4 parent_transform, std::vector<glm::mat4>& binds)
+void Skin::pose(std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals, WorkerPool* pool) const
 {
-    if (!node) { return; }
-    auto trans = glm::translate(parent_transform, node->position_);
-    trans = trans * glm::toMat4(node->rotation_);
-    binds.push_back(glm::inverse(trans));
-
-    for (auto n : node->children_) {
-        build_inverse_bind_array(parent, n, trans, binds);
+    // Same space as the GPU path, see ``Skin::emit``
+    std::array<glm::mat4, 64> joints;
+    auto base = parent_ ? parent_->get_transform() : glm::mat4{1.0f};
+    for (uint32_t i = 0; i < num_bones_; ++i) {
+        joints[i] = base * owner_->palette_[palette_offset_ + i];
     }
+
+    positions.resize(source_vertices_.size());
+    normals.resize(source_vertices_.size());
+    skin_vertices(source_vertices_, std::span<const glm::mat4>(joints.data(), num_bones_), positions, normals, pool);
 }
 
 void Skin::build_inverse_binds()
 {
-    glm::mat4 ptrans{1.0f};
-    Node* parent = this;
-    while (parent->parent_) {
-        parent = parent->parent_;
-        if (parent->has_transform_) {
-            glm::translate(ptrans, parent->position_) * glm::toMat4(parent->rotation_);
-        }
+    // Model transforms are in the bind pose at load time
+    auto trans = glm::translate(glm::mat4{1.0f}, position_) * glm::toMat4(rotation_);
+
+    inverse_bind_pose_.resize(owner_->nodes_.size());
+    for (size_t i = 0; i < owner_->nodes_.size(); ++i) {
+        inverse_bind_pose_[i] = glm::inverse(owner_->worlds_[i]) * trans;
     }
+}
 
-    auto trans = glm::translate(ptrans, position_) * glm::toMat4(rotation_);
+// == InstanceBatcher =========================================================
+// ============================================================================
 
-    build_inverse_bind_array(this, parent, glm::inverse(trans), inverse_bind_pose_);
+void InstanceBatcher::add(Model* model, const glm::mat4& mtx)
+{
+    instances_[model].push_back(mtx);
+}
+
+void InstanceBatcher::clear()
+{
+    // Keep allocations of models drawn this frame around for the next, models that weren't may have been evicted
+    absl::erase_if(instances_, [](const auto& entry) { return entry.second.empty(); });
+    for (auto& [_, instances] : instances_) {
+        instances.clear();
+    }
+}
+
+void InstanceBatcher::submit(RenderQueue& _queue, bgfx::ViewId _id, bgfx::ProgramHandle _program, uint64_t _state,
+    const Frustum* _frustum, CullStats* _stats, const LodSelector* _lod)
+{
+    for (auto& [model, instances] : instances_) {
+        if (instances.size()) {
+            model->submit(_queue, _id, _program, instances, _state, _frustum, _stats, _lod);
+        }
+    }
 }
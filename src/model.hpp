@@ -1,32 +1,77 @@
 #pragma once
 
+#include "NameKey.hpp"
+#include "RenderQueue.hpp"
+#include "animation.hpp"
+#include "culling.hpp"
+#include "lod.hpp"
+#include "packing.hpp"
+
 #include <nw/model/Mdl.hpp>
 
+#include <absl/container/flat_hash_map.h>
 #include <bgfx/bgfx.h>
 #include <glm/glm.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/matrix.hpp>
 
+#include <chrono>
+#include <memory>
+#include <span>
+#include <string>
 #include <vector>
 
+struct BakedModel;
+struct MappedFile;
 struct Model;
+struct TexturePayload;
+struct WorkerPool;
 
 struct Node {
     static bgfx::VertexLayout layout;
     static bgfx::ProgramHandle skinned_program;
+    static bgfx::ProgramHandle instanced_program;
+    static bgfx::ProgramHandle skinned_instanced_program;
 
     virtual ~Node() = default;
     virtual void reset() { }
 
-    glm::mat4 get_transform() const;
+    /// Gets model space transform, valid after ``Model::update_transforms``
+    const glm::mat4& get_transform() const;
+
+    /// Gets transform relative to parent node
+    glm::mat4 local_transform() const;
+
+    /// Sets position, marking the node dirty if it changed
+    void set_position(const glm::vec3& position);
+
+    /// Sets rotation, marking the node dirty if it changed
+    void set_rotation(const glm::quat& rotation);
+
+    /// Adds draws of the node for all ``_instances``, each a model world transform, at level of detail ``_lod``
+    virtual void emit(RenderQueue& _queue, bgfx::ViewId _id, bgfx::ProgramHandle _program,
+        std::span<const glm::mat4> _instances, uint64_t _state, uint32_t _lod) { }
+
+    /// Gets simplified levels of the node, coarsest last
+    virtual std::span<const Lod> lods() const { return {}; }
 
-    /// Submits mesh data to the GPU
-    virtual void submit(bgfx::ViewId _id, bgfx::ProgramHandle _program, const glm::mat4x4& _mtx, uint64_t _state = BGFX_STATE_MASK);
+    /// Creates GPU resources from data staged by ``Model::load``, must be called on the API thread
+    virtual void upload() { }
+
+    /// Gets the size of data staged for ``upload``
+    virtual size_t staged_bytes() const { return 0; }
+
+    /// Gets model space bounds of the current pose, false if the node isn't rendered
+    virtual bool bounds(Sphere& result) const { return false; }
 
     Model* owner_ = nullptr;
+    uint32_t index_ = 0;
+    std::string name_;
+    /// Source node, only set while ``Model::load`` reads it
     nw::model::Node* orig_ = nullptr;
     Node* parent_ = nullptr;
     bool has_transform_ = false;
+    bool dirty_ = true;
     glm::vec3 position_{0.0f};
     glm::quat rotation_{};
     glm::vec3 scale_ = glm::vec3(1.0);
@@ -36,10 +81,76 @@ struct Node {
 };
 
 struct Model : public Node {
-    nw::model::Model* mdl_ = nullptr;
-    nw::model::Animation* anim_ = nullptr;
+    /// Merge static meshes at load time, see ``merge_meshes``
+    static bool merge_static_meshes;
+    /// Build simplified levels of detail of meshes and skins at load time, see ``build_lods``
+    static bool generate_lods;
+
+    ~Model();
+
+    /// Animations of the model itself, see ``compile_animations``
+    std::unique_ptr<AnimationSet> animations_;
+    /// Animations of the supermodel chain, nearest first, owned by the caller and set before ``load``
+    std::vector<const AnimationSet*> supermodels_;
+    const Animation* anim_ = nullptr;
     int32_t anim_cursor_ = 0;
+    std::vector<AnimationBinding> anim_bindings_;
+    /// Nodes in topological order, i.e. every parent precedes its children
     std::vector<std::unique_ptr<Node>> nodes_;
+    /// Index of each node's parent in ``nodes_``, -1 for the root
+    std::vector<int32_t> parents_;
+    std::vector<glm::mat4> locals_;
+    std::vector<glm::mat4> worlds_;
+    /// Scratch flags marking nodes whose world transform changed in the current pass
+    std::vector<uint8_t> world_changed_;
+    /// Set when any node is dirty
+    bool transforms_dirty_ = true;
+    /// Incremented whenever any world transform changes
+    uint32_t transform_version_ = 0;
+
+    /// Joint matrices of all skins, each skin owns a contiguous range of rows
+    std::vector<glm::mat4> palette_;
+    /// ``palette_`` as a 4 x rows RGBA32F texture, invalid when joints are uploaded as uniforms
+    bgfx::TextureHandle joint_palette_ = BGFX_INVALID_HANDLE;
+    /// ``transform_version_`` that ``palette_`` was built from
+    uint32_t palette_version_ = 0;
+
+    /// Model space vertices and indices of all merged static meshes
+    bgfx::VertexBufferHandle static_vbh_ = BGFX_INVALID_HANDLE;
+    bgfx::IndexBufferHandle static_ibh_ = BGFX_INVALID_HANDLE;
+    std::vector<uint8_t> static_vertex_data_;
+    std::vector<uint16_t> static_index_data_;
+    /// ``static_vertex_data_`` and ``static_index_data_`` mapped from a bake instead
+    std::span<const uint8_t> baked_static_vertices_;
+    std::span<const uint16_t> baked_static_indices_;
+
+    /// Mapping of the bake the model was loaded from, kept until uploaded
+    std::shared_ptr<MappedFile> bake_file_;
+
+    /// Next node ``upload`` creates GPU resources for
+    size_t upload_cursor_ = 0;
+    /// Size of vertex and index buffers created by ``upload``
+    size_t gpu_bytes_ = 0;
+
+    /// Culling scratch space
+    std::vector<Sphere> cull_spheres_;
+    std::vector<uint8_t> cull_flags_;
+    std::vector<glm::mat4> visible_instances_;
+    /// Level of detail scratch space, instances by level
+    std::vector<std::vector<glm::mat4>> lod_instances_;
+
+    /// Node name to index into ``nodes_``
+    absl::flat_hash_map<NameKey, uint32_t> node_index_;
+    /// Lowercase node name to index into ``nodes_``, for names too long for a ``NameKey``
+    absl::flat_hash_map<std::string, uint32_t> long_node_index_;
+    /// Lowercase animation name to animation, over the whole supermodel chain
+    absl::flat_hash_map<std::string, const Animation*> animation_index_;
+
+    /// Builds node and animation name indices
+    void build_indices();
+
+    /// Finds a node index by name, ``UINT32_MAX`` if there's none
+    uint32_t find_index(std::string_view name) const;
 
     /// Finds a node by name
     Node* find(std::string_view name);
@@ -47,57 +158,217 @@ struct Model : public Node {
     /// Initialize skin meshes & joints
     void initialize_skins();
 
-    /// Loads model from a NWN model
+    /// Sets up transforms and indices of loaded nodes, then skins
+    void initialize_nodes();
+
+    /// Pre-transforms meshes that no animation moves into model space and concatenates them into one vertex and
+    /// index buffer, with one range per texture.  Ranges are appended to ``nodes_`` and replace their sources.
+    void merge_meshes();
+
+    /// Rebuilds joint palette if any transform changed and uploads it
+    void update_joint_palette();
+
+    /// Loads model from a NWN model, staging vertex data without touching bgfx so it can run on any thread.
+    /// Nothing points into ``mdl`` afterwards.
     bool load(nw::model::Model* mdl);
 
-    /// Loads an animation
+    /// Loads model from a bake written by ``write_bake``, nodes and animations are copied and vertex data stays
+    /// in the mapping until uploaded.  Can run on any thread.
+    bool load(const BakedModel& bake);
+
+    /// Creates GPU resources of staged nodes until ``deadline``, returns true once all are created.
+    /// Must be called on the API thread.
+    bool upload(std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max());
+
+    /// Gets the size of vertex and index data staged for ``upload``, i.e. the GPU memory it will take
+    size_t staged_bytes() const;
+
+    std::span<const uint8_t> staged_static_vertices() const
+    {
+        return baked_static_vertices_.empty() ? std::span<const uint8_t>(static_vertex_data_) : baked_static_vertices_;
+    }
+
+    std::span<const uint16_t> staged_static_indices() const
+    {
+        return baked_static_indices_.empty() ? std::span<const uint16_t>(static_index_data_) : baked_static_indices_;
+    }
+
+    /// Gets the size of what's kept on the CPU for ``posed_bounds`` and animation: mesh positions, skin source
+    /// vertices and the model's own animation keys
+    size_t source_bytes() const;
+
+    /// Loads an animation and binds its tracks to model nodes
     bool load_animation(std::string_view anim);
     Node* load_node(nw::model::Node* node, Node* parent = nullptr);
     void update(int32_t dt);
-    virtual void submit(bgfx::ViewId _id, bgfx::ProgramHandle _program, const glm::mat4& _mtx, uint64_t _state = BGFX_STATE_MASK) override;
+
+    /// Computes model space bounds of the current pose, skins are posed on the CPU
+    bool posed_bounds(glm::vec3& min, glm::vec3& max, WorkerPool* pool = nullptr);
+
+    /// Recomputes local and model space transforms of dirty nodes and their subtrees
+    void update_transforms();
+
+    /// Adds draws for all instances of the model to the render queue, instanced where supported.
+    /// All instances share the model's current pose.  If ``_frustum`` is not null, meshes are culled per instance.
+    /// If ``_lod`` is not null, each instance draws meshes at the level of detail it selects.
+    void submit(RenderQueue& _queue, bgfx::ViewId _id, bgfx::ProgramHandle _program, std::span<const glm::mat4> _instances,
+        uint64_t _state = BGFX_STATE_MASK, const Frustum* _frustum = nullptr, CullStats* _stats = nullptr,
+        const LodSelector* _lod = nullptr);
 };
 
 struct Mesh : public Node {
+    ~Mesh();
     virtual void reset() override { }
-    // Submits mesh data to the GPU
-    virtual void submit(bgfx::ViewId _id, bgfx::ProgramHandle _program, const glm::mat4& _mtx, uint64_t _state = BGFX_STATE_MASK) override;
+    virtual void emit(RenderQueue& _queue, bgfx::ViewId _id, bgfx::ProgramHandle _program,
+        std::span<const glm::mat4> _instances, uint64_t _state, uint32_t _lod) override;
+    virtual std::span<const Lod> lods() const override { return lods_; }
+    virtual void upload() override;
+    virtual size_t staged_bytes() const override
+    {
+        return staged_vertices().size() + staged_indices().size() * sizeof(uint16_t);
+    }
+    virtual bool bounds(Sphere& result) const override;
 
-    bgfx::VertexBufferHandle vbh_;
-    bgfx::IndexBufferHandle ibh_;
-    uint16_t num_vertices_ = 0;
+    bgfx::VertexBufferHandle vbh_ = BGFX_INVALID_HANDLE;
+    bgfx::IndexBufferHandle ibh_ = BGFX_INVALID_HANDLE;
+    uint32_t num_vertices_ = 0;
     uint8_t* vertices_ = nullptr;
     uint32_t num_indices_ = 0;
     uint16_t* indices_ = nullptr;
+    /// Range of ``vbh_`` and ``ibh_`` to draw if ``num_indices_`` is non-zero, otherwise the whole buffers
+    uint32_t first_vertex_ = 0;
+    uint32_t first_index_ = 0;
+    /// Set when the mesh is drawn as part of a merged range, see ``Model::merge_meshes``
+    bool merged_ = false;
+    /// Set on merged ranges, which draw from the model's buffers
+    bool range_ = false;
+    /// Maps packed positions of ``vbh_`` to node space
+    Dequantize dequant_;
+    /// Index ranges of ``ibh_`` simplified from the full detail range
+    std::vector<Lod> lods_;
+    /// Texture resref of ``texture0``
+    std::string bitmap_;
+    /// Packed vertices and indices staged by ``Model::load`` until ``upload``
+    std::vector<uint8_t> vertex_data_;
+    std::vector<uint16_t> index_data_;
+    /// ``vertex_data_`` and ``index_data_`` mapped from a bake instead
+    std::span<const uint8_t> baked_vertices_;
+    std::span<const uint16_t> baked_indices_;
+
+    std::span<const uint8_t> staged_vertices() const
+    {
+        return baked_vertices_.empty() ? std::span<const uint8_t>(vertex_data_) : baked_vertices_;
+    }
+
+    std::span<const uint16_t> staged_indices() const
+    {
+        return baked_indices_.empty() ? std::span<const uint16_t>(index_data_) : baked_indices_;
+    }
 
-    bgfx::TextureHandle texture0;
+    /// Shows the placeholder until the texture is uploaded
+    TexturePayload* texture0 = nullptr;
     // bgfx::TextureHandle texture1;
     // bgfx::TextureHandle texture2;
     // bgfx::TextureHandle texture3;
 
-    // bx::Sphere sphere_;
-    // bx::Aabb   aabb_;
-    // bx::Obb    obb_;
+    /// Node space bounds
+    Aabb aabb_;
+    Sphere sphere_;
+    /// Node space vertex positions, outliving the source vertices for ``Model::posed_bounds``
+    std::vector<glm::vec3> positions_;
     // PrimitiveArray prims_;
 };
 
 struct Skin : public Node {
     static bgfx::VertexLayout layout;
+    /// Skinning program reading joints from the model's palette texture, invalid if unsupported
+    static bgfx::ProgramHandle palette_program;
+    static bgfx::ProgramHandle palette_instanced_program;
 
+    ~Skin();
     virtual void reset() override { }
-    // Submits mesh data to the GPU
-    virtual void submit(bgfx::ViewId _id, bgfx::ProgramHandle _program, const glm::mat4& _mtx, uint64_t _state = BGFX_STATE_MASK) override;
+    virtual void emit(RenderQueue& _queue, bgfx::ViewId _id, bgfx::ProgramHandle _program,
+        std::span<const glm::mat4> _instances, uint64_t _state, uint32_t _lod) override;
+    virtual std::span<const Lod> lods() const override { return lods_; }
+    virtual void upload() override;
+    virtual size_t staged_bytes() const override
+    {
+        return staged_vertices().size() + staged_indices().size() * sizeof(uint16_t);
+    }
+
+    virtual bool bounds(Sphere& result) const override;
+
+    /// Gets the joint palette range of this skin
+    SkinBinding joint_binding() const;
 
     void build_inverse_binds();
-    bgfx::VertexBufferHandle vbh_;
-    bgfx::IndexBufferHandle ibh_;
+
+    /// Poses vertices in model space on the CPU from the current joint palette, see
+    /// ``Model::update_joint_palette``
+    void pose(std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals, WorkerPool* pool = nullptr) const;
+
+    bgfx::VertexBufferHandle vbh_ = BGFX_INVALID_HANDLE;
+    bgfx::IndexBufferHandle ibh_ = BGFX_INVALID_HANDLE;
     uint16_t num_vertices_ = 0;
     uint8_t* vertices_ = nullptr;
     uint32_t num_indices_ = 0;
     uint16_t* indices_ = nullptr;
     std::vector<glm::mat4> inverse_bind_pose_;
-    std::array<glm::mat4, 64> joints_;
+    /// First row of this skin's joints in ``Model::palette_``
+    uint32_t palette_offset_ = 0;
+    /// Number of bones referenced by this skin
+    uint32_t num_bones_ = 0;
+    /// Index in ``Model::nodes_`` of each bone slot
+    std::vector<uint32_t> bone_nodes_;
+    /// Node space source vertices, posed on the CPU by ``pose``
+    std::vector<nw::model::SkinVertex> source_vertices_;
+    /// Per bone slot, max distance of any vertex it influences from the bone
+    std::vector<float> bone_radii_;
+    /// Maps packed positions of ``vbh_`` to node space, applied in the vertex shader before skinning
+    Dequantize dequant_;
+    /// Index ranges of ``ibh_`` simplified from the full detail range
+    std::vector<Lod> lods_;
+    /// Texture resref of ``texture0``
+    std::string bitmap_;
+    /// Packed vertices and indices staged by ``Model::load`` until ``upload``
+    std::vector<uint8_t> vertex_data_;
+    std::vector<uint16_t> index_data_;
+    /// ``vertex_data_`` and ``index_data_`` mapped from a bake instead
+    std::span<const uint8_t> baked_vertices_;
+    std::span<const uint16_t> baked_indices_;
+
+    std::span<const uint8_t> staged_vertices() const
+    {
+        return baked_vertices_.empty() ? std::span<const uint8_t>(vertex_data_) : baked_vertices_;
+    }
+
+    std::span<const uint16_t> staged_indices() const
+    {
+        return baked_indices_.empty() ? std::span<const uint16_t>(index_data_) : baked_indices_;
+    }
 
-    bgfx::TextureHandle texture0;
+    /// Shows the placeholder until the texture is uploaded
+    TexturePayload* texture0 = nullptr;
+};
+
+/// Groups model instances so that each mesh is drawn once per frame for all instances of a model
+struct InstanceBatcher {
+    void add(Model* model, const glm::mat4& mtx);
+    /// Empties all batches and forgets models that weren't added since the last call, so evicted models don't
+    /// linger as keys
+    void clear();
+    void submit(RenderQueue& _queue, bgfx::ViewId _id, bgfx::ProgramHandle _program, uint64_t _state = BGFX_STATE_MASK,
+        const Frustum* _frustum = nullptr, CullStats* _stats = nullptr, const LodSelector* _lod = nullptr);
+
+    absl::flat_hash_map<Model*, std::vector<glm::mat4>> instances_;
 };
 
 Model* load_model(nw::model::Model* mdl);
+
+/// Copies position and orientation keys of all animations of ``mdl``, skipping nodes with neither
+std::unique_ptr<AnimationSet> compile_animations(const nw::model::Model& mdl);
+
+/// Initializes ``Node::layout`` and ``Skin::layout`` as packed layouts with ``attributes``, see ``VertexAttributes``.
+/// Vertex programs only read positions and texture coordinates, so by default everything else is stripped.
+/// Reads renderer caps, so must be called after ``bgfx::init``.
+void init_vertex_layouts(uint32_t attributes = vertex_position_texcoord);
@@ -0,0 +1,183 @@
+#include "packing.hpp"
+
+#include <bx/math.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+inline int16_t to_snorm16(float v)
+{
+    return int16_t(std::lround(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+template <typename T>
+inline void store(uint8_t* dst, const T& value)
+{
+    std::memcpy(dst, &value, sizeof(T));
+}
+
+// Writes attributes shared by meshes and skins
+void pack_common(uint8_t* dst, const glm::vec3& position, const glm::vec2& tex_coords, const glm::vec3& normal,
+    const glm::vec4& tangent, const Dequantize& dequant, const bgfx::VertexLayout& layout, bool half_uv)
+{
+    auto p = (position - dequant.offset) / dequant.scale;
+    int16_t pos[4] = {to_snorm16(p.x), to_snorm16(p.y), to_snorm16(p.z), 32767};
+    store(dst + layout.getOffset(bgfx::Attrib::Position), pos);
+
+    if (half_uv) {
+        uint16_t uv[2] = {bx::halfFromFloat(tex_coords.x), bx::halfFromFloat(tex_coords.y)};
+        store(dst + layout.getOffset(bgfx::Attrib::TexCoord0), uv);
+    } else {
+        store(dst + layout.getOffset(bgfx::Attrib::TexCoord0), tex_coords);
+    }
+
+    if (layout.has(bgfx::Attrib::Normal)) {
+        auto e = oct_encode(normal);
+        int16_t n[2] = {to_snorm16(e.x), to_snorm16(e.y)};
+        store(dst + layout.getOffset(bgfx::Attrib::Normal), n);
+    }
+
+    if (layout.has(bgfx::Attrib::Tangent)) {
+        auto e = oct_encode(glm::vec3{tangent.x, tangent.y, tangent.z});
+        int16_t t[4] = {to_snorm16(e.x), to_snorm16(e.y), int16_t(tangent.w < 0.0f ? -32767 : 32767), 0};
+        store(dst + layout.getOffset(bgfx::Attrib::Tangent), t);
+    }
+}
+
+void add_common(bgfx::VertexLayout& layout, uint32_t attributes, bgfx::AttribType::Enum texcoord)
+{
+    layout.add(bgfx::Attrib::Position, 4, bgfx::AttribType::Int16, true)
+        .add(bgfx::Attrib::TexCoord0, 2, texcoord);
+    if (attributes & vertex_normal) {
+        layout.add(bgfx::Attrib::Normal, 2, bgfx::AttribType::Int16, true);
+    }
+    if (attributes & vertex_tangent) {
+        layout.add(bgfx::Attrib::Tangent, 4, bgfx::AttribType::Int16, true);
+    }
+}
+
+} // namespace
+
+glm::mat4 Dequantize::matrix() const
+{
+    glm::mat4 result{1.0f};
+    result[0][0] = scale.x;
+    result[1][1] = scale.y;
+    result[2][2] = scale.z;
+    result[3] = glm::vec4{offset, 1.0f};
+    return result;
+}
+
+Dequantize make_dequantize(const Aabb& aabb)
+{
+    Dequantize result;
+    result.offset = (aabb.min + aabb.max) * 0.5f;
+    result.scale = glm::max((aabb.max - aabb.min) * 0.5f, glm::vec3{1e-6f});
+    return result;
+}
+
+bgfx::VertexLayout packed_mesh_layout(uint32_t attributes, bgfx::AttribType::Enum texcoord)
+{
+    bgfx::VertexLayout layout;
+    layout.begin();
+    add_common(layout, attributes, texcoord);
+    layout.end();
+    return layout;
+}
+
+bgfx::VertexLayout packed_skin_layout(uint32_t attributes, bgfx::AttribType::Enum texcoord)
+{
+    bgfx::VertexLayout layout;
+    layout.begin();
+    add_common(layout, attributes, texcoord);
+    layout.add(bgfx::Attrib::Indices, 4, bgfx::AttribType::Uint8, false, true)
+        .add(bgfx::Attrib::Weight, 4, bgfx::AttribType::Uint8, true)
+        .end();
+    return layout;
+}
+
+bgfx::AttribType::Enum texcoord_type(const bgfx::VertexLayout& layout)
+{
+    uint8_t num = 0;
+    bgfx::AttribType::Enum type = bgfx::AttribType::Count;
+    bool normalized = false, as_int = false;
+    layout.decode(bgfx::Attrib::TexCoord0, num, type, normalized, as_int);
+    return type;
+}
+
+glm::vec2 oct_encode(const glm::vec3& n)
+{
+    auto p = n / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z) + 1e-20f);
+    if (p.z < 0.0f) {
+        return glm::vec2{
+            (1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+            (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f)};
+    }
+    return glm::vec2{p.x, p.y};
+}
+
+glm::vec3 oct_decode(const glm::vec2& e)
+{
+    glm::vec3 n{e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y)};
+    if (n.z < 0.0f) {
+        n.x = (1.0f - std::abs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - std::abs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f);
+    }
+    return glm::normalize(n);
+}
+
+void pack_vertices(std::span<const nw::model::Vertex> vertices, const Dequantize& dequant,
+    const bgfx::VertexLayout& layout, std::vector<uint8_t>& out)
+{
+    const size_t stride = layout.getStride();
+    const bool half_uv = texcoord_type(layout) == bgfx::AttribType::Half;
+    size_t start = out.size();
+    out.resize(start + vertices.size() * stride);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        const auto& v = vertices[i];
+        pack_common(out.data() + start + i * stride, v.position, v.tex_coords, v.normal, v.tangent, dequant, layout,
+            half_uv);
+    }
+}
+
+void pack_skin_vertices(std::span<const nw::model::SkinVertex> vertices, const Dequantize& dequant,
+    const bgfx::VertexLayout& layout, std::vector<uint8_t>& out)
+{
+    const size_t stride = layout.getStride();
+    const bool half_uv = texcoord_type(layout) == bgfx::AttribType::Half;
+    size_t start = out.size();
+    out.resize(start + vertices.size() * stride);
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        const auto& v = vertices[i];
+        auto dst = out.data() + start + i * stride;
+        pack_common(dst, v.position, v.tex_coords, v.normal, v.tangent, dequant, layout, half_uv);
+
+        uint8_t bones[4] = {0, 0, 0, 0};
+        float weights[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        float total = 0.0f;
+        for (int k = 0; k < 4; ++k) {
+            if (v.weights[k] <= 0.0f || v.bones[k] < 0 || v.bones[k] > 255) { continue; }
+            bones[k] = uint8_t(v.bones[k]);
+            weights[k] = v.weights[k];
+            total += v.weights[k];
+        }
+
+        // Rounding error goes to the largest influence so weights sum to one after unpacking
+        uint8_t packed[4] = {0, 0, 0, 0};
+        if (total > 0.0f) {
+            int sum = 0, largest = 0;
+            for (int k = 0; k < 4; ++k) {
+                packed[k] = uint8_t(std::lround(weights[k] / total * 255.0f));
+                sum += packed[k];
+                if (weights[k] > weights[largest]) { largest = k; }
+            }
+            packed[largest] = uint8_t(packed[largest] + 255 - sum);
+        }
+
+        store(dst + layout.getOffset(bgfx::Attrib::Indices), bones);
+        store(dst + layout.getOffset(bgfx::Attrib::Weight), packed);
+    }
+}
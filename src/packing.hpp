@@ -0,0 +1,57 @@
+#pragma once
+
+#include "culling.hpp"
+
+#include <bgfx/bgfx.h>
+#include <glm/glm.hpp>
+#include <nw/model/Mdl.hpp>
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+/// Optional vertex attributes, anything not consumed by the vertex programs is stripped at load
+enum VertexAttributes : uint32_t {
+    vertex_position_texcoord = 0,
+    /// Octahedral encoded normal as two snorm16
+    vertex_normal = 1 << 0,
+    /// Octahedral encoded tangent as two snorm16, bitangent sign and padding as snorm16
+    vertex_tangent = 1 << 1,
+};
+
+/// Maps snorm16 positions back to node space, ``position = quantized * scale + offset``
+struct Dequantize {
+    glm::vec3 offset{0.0f};
+    glm::vec3 scale{1.0f};
+
+    /// Gets a matrix that dequantizes positions, to be applied before the node transform
+    glm::mat4 matrix() const;
+};
+
+/// Computes dequantization covering ``aabb``
+Dequantize make_dequantize(const Aabb& aabb);
+
+/// Packed mesh layout: snorm16x4 position, ``texcoord`` x2 texture coordinates, and optional attributes.
+/// Texture coordinates are half unless the renderer lacks ``BGFX_CAPS_VERTEX_ATTRIB_HALF``, then float, since
+/// tiling coordinates don't fit a normalized type.
+bgfx::VertexLayout packed_mesh_layout(uint32_t attributes, bgfx::AttribType::Enum texcoord = bgfx::AttribType::Half);
+
+/// Packed skin layout: packed mesh layout plus uint8x4 bone indices and unorm8x4 weights
+bgfx::VertexLayout packed_skin_layout(uint32_t attributes, bgfx::AttribType::Enum texcoord = bgfx::AttribType::Half);
+
+/// Gets the type of texture coordinates in ``layout``, half or float
+bgfx::AttribType::Enum texcoord_type(const bgfx::VertexLayout& layout);
+
+/// Encodes a unit vector into the octahedral [-1, 1] square
+glm::vec2 oct_encode(const glm::vec3& n);
+
+/// Decodes a vector encoded with ``oct_encode``
+glm::vec3 oct_decode(const glm::vec2& e);
+
+/// Appends vertices packed with ``layout`` to ``out``
+void pack_vertices(std::span<const nw::model::Vertex> vertices, const Dequantize& dequant,
+    const bgfx::VertexLayout& layout, std::vector<uint8_t>& out);
+
+/// Appends skin vertices packed with ``layout`` to ``out``, weights are renormalized to sum to exactly 255
+void pack_skin_vertices(std::span<const nw::model::SkinVertex> vertices, const Dequantize& dequant,
+    const bgfx::VertexLayout& layout, std::vector<uint8_t>& out);
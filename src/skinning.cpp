@@ -0,0 +1,115 @@
+#include "skinning.hpp"
+
+#include "WorkerPool.hpp"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define MUDL_SKINNING_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MUDL_SKINNING_SSE 1
+#endif
+
+#include <cmath>
+
+// Vertices per chunk when splitting work across threads
+constexpr size_t skinning_grain = 2048;
+
+inline bool valid_influence(const nw::model::SkinVertex& v, int k, size_t num_joints)
+{
+    return v.weights[k] != 0.0f && v.bones[k] >= 0 && size_t(v.bones[k]) < num_joints;
+}
+
+inline glm::vec3 normalize_safe(float x, float y, float z)
+{
+    float len = std::sqrt(x * x + y * y + z * z);
+    if (len <= 0.0f) { return glm::vec3{0.0f}; }
+    return glm::vec3{x / len, y / len, z / len};
+}
+
+#if defined(MUDL_SKINNING_AVX) || defined(MUDL_SKINNING_SSE)
+
+inline void store_vertex(__m128 c0, __m128 c1, __m128 c2, __m128 c3, const nw::model::SkinVertex& v,
+    glm::vec3& position, glm::vec3& normal)
+{
+    __m128 p = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(v.position.x)), _mm_mul_ps(c1, _mm_set1_ps(v.position.y))),
+        _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(v.position.z)), c3));
+    __m128 n = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(v.normal.x)), _mm_mul_ps(c1, _mm_set1_ps(v.normal.y))),
+        _mm_mul_ps(c2, _mm_set1_ps(v.normal.z)));
+
+    alignas(16) float out[8];
+    _mm_store_ps(out, p);
+    _mm_store_ps(out + 4, n);
+    position = glm::vec3{out[0], out[1], out[2]};
+    normal = normalize_safe(out[4], out[5], out[6]);
+}
+
+#endif
+
+static void skin_range(const nw::model::SkinVertex* vertices, const glm::mat4* joints, size_t num_joints,
+    glm::vec3* positions, glm::vec3* normals, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; ++i) {
+        const auto& v = vertices[i];
+
+#if defined(MUDL_SKINNING_AVX)
+        // Two matrix columns per register
+        __m256 c01 = _mm256_setzero_ps();
+        __m256 c23 = _mm256_setzero_ps();
+        for (int k = 0; k < 4; ++k) {
+            if (!valid_influence(v, k, num_joints)) { continue; }
+            const float* m = &joints[v.bones[k]][0][0];
+            __m256 w = _mm256_set1_ps(v.weights[k]);
+            c01 = _mm256_add_ps(c01, _mm256_mul_ps(w, _mm256_loadu_ps(m)));
+            c23 = _mm256_add_ps(c23, _mm256_mul_ps(w, _mm256_loadu_ps(m + 8)));
+        }
+        store_vertex(_mm256_castps256_ps128(c01), _mm256_extractf128_ps(c01, 1),
+            _mm256_castps256_ps128(c23), _mm256_extractf128_ps(c23, 1), v, positions[i], normals[i]);
+
+#elif defined(MUDL_SKINNING_SSE)
+        __m128 c0 = _mm_setzero_ps();
+        __m128 c1 = _mm_setzero_ps();
+        __m128 c2 = _mm_setzero_ps();
+        __m128 c3 = _mm_setzero_ps();
+        for (int k = 0; k < 4; ++k) {
+            if (!valid_influence(v, k, num_joints)) { continue; }
+            const float* m = &joints[v.bones[k]][0][0];
+            __m128 w = _mm_set1_ps(v.weights[k]);
+            c0 = _mm_add_ps(c0, _mm_mul_ps(w, _mm_loadu_ps(m)));
+            c1 = _mm_add_ps(c1, _mm_mul_ps(w, _mm_loadu_ps(m + 4)));
+            c2 = _mm_add_ps(c2, _mm_mul_ps(w, _mm_loadu_ps(m + 8)));
+            c3 = _mm_add_ps(c3, _mm_mul_ps(w, _mm_loadu_ps(m + 12)));
+        }
+        store_vertex(c0, c1, c2, c3, v, positions[i], normals[i]);
+
+#else
+        glm::mat4 blended{0.0f};
+        for (int k = 0; k < 4; ++k) {
+            if (!valid_influence(v, k, num_joints)) { continue; }
+            blended = blended + joints[v.bones[k]] * v.weights[k];
+        }
+        auto p = blended * glm::vec4{v.position, 1.0f};
+        auto n = blended * glm::vec4{v.normal, 0.0f};
+        positions[i] = glm::vec3{p.x, p.y, p.z};
+        normals[i] = normalize_safe(n.x, n.y, n.z);
+#endif
+    }
+}
+
+void skin_vertices(std::span<const nw::model::SkinVertex> vertices, std::span<const glm::mat4> joints,
+    std::span<glm::vec3> positions, std::span<glm::vec3> normals, WorkerPool* pool)
+{
+    if (positions.size() < vertices.size() || normals.size() < vertices.size()) { return; }
+
+    auto fn = [&](size_t begin, size_t end) {
+        skin_range(vertices.data(), joints.data(), joints.size(), positions.data(), normals.data(), begin, end);
+    };
+
+    if (pool) {
+        pool->parallel_for(vertices.size(), skinning_grain, fn);
+    } else {
+        fn(0, vertices.size());
+    }
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <nw/model/Mdl.hpp>
+
+#include <span>
+
+struct WorkerPool;
+
+/// Poses skin vertices on the CPU, mirroring ``vs_skin_mudl.sc``.  ``joints`` is indexed by the
+/// vertex bone slots, and output spans must be at least as large as ``vertices``.  Normals
+/// are renormalized.  If ``pool`` is not null vertex ranges are split across its workers.
+void skin_vertices(std::span<const nw::model::SkinVertex> vertices, std::span<const glm::mat4> joints,
+    std::span<glm::vec3> positions, std::span<glm::vec3> normals, WorkerPool* pool = nullptr);
@@ -1,11 +1,18 @@
 #include "util.hpp"
 
 #include <nw/log.hpp>
+#include <nw/util/ByteArray.hpp>
 
 #include <bgfx/bgfx.h>
 #include <bx/bx.h>
 #include <glm/gtc/type_ptr.hpp>
 
+std::mutex& resman_mutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
 std::filesystem::path get_shader_path()
 {
     std::filesystem::path path;
@@ -48,6 +55,20 @@ std::filesystem::path get_shader_path()
     return path;
 }
 
+bgfx::ProgramHandle load_program(std::string_view vs, std::string_view fs)
+{
+    auto vs_bytes = nw::ByteArray::from_file(get_shader_path() / (std::string(vs) + ".bin"));
+    auto fs_bytes = nw::ByteArray::from_file(get_shader_path() / (std::string(fs) + ".bin"));
+    if (vs_bytes.size() == 0 || fs_bytes.size() == 0) {
+        LOG_F(ERROR, "Failed to load shaders: {}, {}", vs, fs);
+        return BGFX_INVALID_HANDLE;
+    }
+
+    auto vs_handle = bgfx::createShader(bgfx::copy(vs_bytes.data(), uint32_t(vs_bytes.size())));
+    auto fs_handle = bgfx::createShader(bgfx::copy(fs_bytes.data(), uint32_t(fs_bytes.size())));
+    return bgfx::createProgram(vs_handle, fs_handle, true);
+}
+
 void log_matrix(const float* mtx)
 {
     LOG_F(INFO, "\n[{}, {}, {}, {}]\n[{}, {}, {}, {}]\n[{}, {}, {}, {}]\n[{}, {}, {}, {}]",
@@ -1,12 +1,22 @@
 #pragma once
 
+#include <bgfx/bgfx.h>
 #include <glm/glm.hpp>
 
 #include <filesystem>
+#include <mutex>
+#include <string_view>
+
+// Guards ``nw::kernel::resman()``, which isn't thread safe.  Parsing an MDL demands its supermodels, so parsing
+// holds it too.
+std::mutex& resman_mutex();
 
 // Gets path to the shaders depending on bgfx backend
 std::filesystem::path get_shader_path();
 
+// Loads a program from compiled shaders, returns an invalid handle if either is missing
+bgfx::ProgramHandle load_program(std::string_view vs, std::string_view fs);
+
 // Logs matrix
 void log_matrix(const float* mtx);
 void log_matrix(const glm::mat4& mtx);
@@ -6,3 +6,8 @@ vec4 a_normal       : NORMAL;
 vec4 a_tangent      : TANGENT;
 vec4 a_weight       : BLENDWEIGHT;
 ivec4 a_indices     : BLENDINDICES;
+
+vec4 i_data0        : TEXCOORD7;
+vec4 i_data1        : TEXCOORD6;
+vec4 i_data2        : TEXCOORD5;
+vec4 i_data3        : TEXCOORD4;
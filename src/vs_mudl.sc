@@ -1,4 +1,4 @@
-$input a_position, a_texcoord0, a_normal, a_tangent,
+$input a_position, a_texcoord0
 $output v_texcoord0
 
 #include "common.sh"
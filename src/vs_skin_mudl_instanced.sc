@@ -0,0 +1,24 @@
+$input a_position, a_texcoord0, a_indices, a_weight, i_data0, i_data1, i_data2, i_data3
+$output v_texcoord0
+
+// Must match max_uniform_joints in RenderQueue.hpp
+uniform mat4 u_joints[64];
+
+#include "common.sh"
+
+// Packed position offset and scale, see ``Dequantize``
+uniform vec4 u_dequant[2];
+
+void main()
+{
+    mat4 instance = mtxFromCols(i_data0, i_data1, i_data2, i_data3);
+    mat4 model = mul(instance, a_weight.x * u_joints[int(a_indices.x)] +
+        a_weight.y * u_joints[int(a_indices.y)] +
+        a_weight.z * u_joints[int(a_indices.z)] +
+        a_weight.w * u_joints[int(a_indices.w)]);
+
+    vec3 v_wpos = mul(model, vec4(a_position * u_dequant[1].xyz + u_dequant[0].xyz, 1.0) ).xyz;
+
+    gl_Position = mul(u_viewProj, vec4(v_wpos, 1.0));
+    v_texcoord0 = a_texcoord0;
+}
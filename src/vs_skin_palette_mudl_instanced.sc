@@ -0,0 +1,36 @@
+$input a_position, a_texcoord0, a_indices, a_weight, i_data0, i_data1, i_data2, i_data3
+$output v_texcoord0
+
+#include "common.sh"
+
+// Packed position offset and scale, see ``Dequantize``
+uniform vec4 u_dequant[2];
+
+SAMPLER2D(s_joints, 1);
+
+// x: first palette row of the skin, y: 1 / number of palette rows
+uniform vec4 u_skinPalette;
+
+mat4 get_joint(float _index)
+{
+    float v = (u_skinPalette.x + _index + 0.5) * u_skinPalette.y;
+    return mtxFromCols(
+        texture2DLod(s_joints, vec2(0.125, v), 0.0),
+        texture2DLod(s_joints, vec2(0.375, v), 0.0),
+        texture2DLod(s_joints, vec2(0.625, v), 0.0),
+        texture2DLod(s_joints, vec2(0.875, v), 0.0));
+}
+
+void main()
+{
+    mat4 instance = mtxFromCols(i_data0, i_data1, i_data2, i_data3);
+    mat4 model = mul(instance, a_weight.x * get_joint(float(a_indices.x)) +
+        a_weight.y * get_joint(float(a_indices.y)) +
+        a_weight.z * get_joint(float(a_indices.z)) +
+        a_weight.w * get_joint(float(a_indices.w)));
+
+    vec3 v_wpos = mul(model, vec4(a_position * u_dequant[1].xyz + u_dequant[0].xyz, 1.0) ).xyz;
+
+    gl_Position = mul(u_viewProj, vec4(v_wpos, 1.0));
+    v_texcoord0 = a_texcoord0;
+}